@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <vector>
+#include "../cachesim.hpp"
+#include "../trace.hpp"
+#include "../workload.hpp"
+
+// Throughput of sim_access on fixed synthetic workloads, one JSON document per run
+
+#define BENCH_ACCESSES 2000000          // Default accesses of all nodes per case
+#define BENCH_REPS 3                    // Default runs per case, the fastest is reported
+#define BENCH_WORKLOAD "zipf:footprint=256M,writes=0.3,seed=1"
+#define BENCH_CACHE 18                  // Metadata cache size (log bytes) of every case
+#define BENCH_WRITE_THRESH 3            // Writes before a block switches to single owner with hybrid coherence
+
+typedef struct bench_case {
+    bool eager;
+    bool hybrid;
+    uint64_t s;                     // Ways (log)
+    uint64_t num_nodes;
+} bench_case_t;
+
+// Sent back by the process that ran a case
+typedef struct bench_result {
+    double seconds;                 // Fastest run
+    uint64_t accesses;
+    uint64_t cache_accesses;        // Totals of all nodes, to tell apart a faster engine from a different one
+    uint64_t hits;
+    uint64_t dram_accesses;
+} bench_result_t;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Every node count with each update and coherence policy at 4 ways, then the other associativities
+static std::vector<bench_case_t> bench_cases(void) {
+    std::vector<bench_case_t> cases;
+    for (uint64_t num_nodes : {1, 2, 4}) {
+        for (bool eager : {true, false}) {
+            for (bool hybrid : {false, true}) {
+                cases.push_back({eager, hybrid, 2, num_nodes});
+            }
+        }
+    }
+    for (uint64_t s : {0, 1, 3, 4, 5, 6}) {
+        for (bool eager : {true, false}) {
+            cases.push_back({eager, false, s, 4});
+        }
+    }
+    return cases;
+}
+
+/**
+ * @brief Generate the accesses of a case, then time sim_access over them
+ *
+ * Records are interleaved one per node per round, as the simulator reads its traces.
+ */
+static void bench_run(const bench_case_t *bc, const workload_config_t *workload, uint64_t accesses, int reps,
+                      bench_result_t *result) {
+    workload_config_t wl = *workload;
+    wl.num_nodes = bc->num_nodes;
+    wl.length = accesses / bc->num_nodes;
+    std::vector<trace_t *> trace;
+    for (uint64_t i = 0; i < wl.num_nodes; i++) {
+        trace.push_back(workload_open(&wl, i));
+    }
+    std::vector<uint64_t> recs(wl.length * wl.num_nodes);
+    for (uint64_t r = 0; r < wl.length; r++) {
+        for (uint64_t i = 0; i < wl.num_nodes; i++) {
+            recs[r * wl.num_nodes + i] = trace_read_rec(trace[i]);
+        }
+    }
+    for (auto t : trace) {
+        trace_close(t);
+    }
+
+    sim_config_t config = {BENCH_CACHE, bc->s, 0, 0, bc->eager, 0, bc->hybrid, 0};
+    config.write_thresh = bc->hybrid ? BENCH_WRITE_THRESH : 0;
+    config.num_nodes = bc->num_nodes;
+    config.arity = BLOCKS_PER_TOC_NODE;
+    config.block_size = CPU_CACHE_BLOCK_SIZE;
+    config.mem_size = MAX_MEM_SIZE;
+    memset(result, 0, sizeof *result);
+    result->accesses = recs.size();
+    for (int rep = 0; rep < reps; rep++) {
+        sim_t sim;
+        sim_setup(&sim, &config);
+        uint64_t num_nodes = config.num_nodes;
+        double start = bench_now();
+        for (size_t k = 0; k < recs.size(); k++) {
+            uint64_t rec = recs[k];
+            sim_access(&sim, k % num_nodes, rec & TRACE_REC_RW, rec & ~TRACE_REC_RW);
+        }
+        double seconds = bench_now() - start;
+        sim_finish(&sim);
+        if (rep == 0 || seconds < result->seconds) {
+            result->seconds = seconds;
+        }
+        result->cache_accesses = result->hits = result->dram_accesses = 0;
+        for (const auto &stats : sim.stats) {
+            result->cache_accesses += stats.accesses_l1;
+            result->hits += stats.hits_l1;
+            result->dram_accesses += stats.num_dram_accesses;
+        }
+    }
+}
+
+/**
+ * @brief Run a case in a child process so its peak RSS is its own
+ *
+ * @param peak_rss Filled with the peak resident set of the child in KB, generated accesses included
+ * @return 0 on success, -1 on error
+ */
+static int bench_fork(const bench_case_t *bc, const workload_config_t *workload, uint64_t accesses, int reps,
+                      bench_result_t *result, long *peak_rss) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        bench_run(bc, workload, accesses, reps, result);
+        bool ok = write(fds[1], result, sizeof *result) == sizeof *result;
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    bool ok = read(fds[0], result, sizeof *result) == sizeof *result;
+    close(fds[0]);
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        perror("wait4");
+        return -1;
+    }
+    if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Benchmark case failed\n");
+        return -1;
+    }
+    *peak_rss = ru.ru_maxrss;
+    return 0;
+}
+
+static void print_help(void) {
+    printf("bench [OPTIONS]\n");
+    printf("Time sim_access on synthetic workloads and print the results as JSON\n");
+    printf("  --accesses N\tAccesses of all nodes per case (default: %d)\n", BENCH_ACCESSES);
+    printf("  --reps R\tRuns per case, the fastest is reported (default: %d)\n", BENCH_REPS);
+    printf("  --workload SPEC\tWorkload as with cachesim --synth, its node count and length are set by\n");
+    printf("\t\teach case (default: %s)\n", BENCH_WORKLOAD);
+    printf("  --out FILE\tWrite the JSON to FILE instead of stdout\n");
+}
+
+int main(int argc, char **argv) {
+    uint64_t accesses = BENCH_ACCESSES;
+    int reps = BENCH_REPS;
+    const char *workload_spec = BENCH_WORKLOAD;
+    const char *out_path = NULL;
+    int opt;
+
+    static const struct option long_opts[] = {
+        {"accesses", required_argument, NULL, 'a'},
+        {"reps", required_argument, NULL, 'r'},
+        {"workload", required_argument, NULL, 'w'},
+        {"out", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    while (-1 != (opt = getopt_long(argc, argv, "h", long_opts, NULL))) {
+        switch (opt) {
+        case 'a':
+            accesses = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 'w':
+            workload_spec = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'h':
+            print_help();
+            return 0;
+        default:
+            print_help();
+            return 1;
+        }
+    }
+    workload_config_t workload;
+    if (workload_parse(workload_spec, &workload) < 0) {
+        return 1;
+    }
+    if (accesses < 4 || reps < 1) {
+        printf("A case needs at least 4 accesses and one run\n");
+        return 1;
+    }
+    FILE *out = stdout;
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (out == NULL) {
+            perror("fopen");
+            return 1;
+        }
+    }
+
+    std::vector<bench_case_t> cases = bench_cases();
+    fprintf(out, "{\n  \"workload\": \"%s\",\n  \"cache_bytes\": %llu,\n  \"reps\": %d,\n  \"cases\": [\n",
+            workload_spec, 1ULL << BENCH_CACHE, reps);
+    int ret = 0;
+    for (size_t k = 0; k < cases.size(); k++) {
+        const bench_case_t *bc = &cases[k];
+        char name[64];
+        snprintf(name, sizeof name, "%s%s_%lluway_%" PRIu64 "node", bc->eager ? "eager" : "lazy",
+                 bc->hybrid ? "_hybrid" : "", 1ULL << bc->s, bc->num_nodes);
+        fprintf(stderr, "%s\n", name);
+        bench_result_t result;
+        long peak_rss;
+        if (bench_fork(bc, &workload, accesses, reps, &result, &peak_rss) < 0) {
+            ret = 1;
+            break;
+        }
+        fprintf(out,
+                "%s    {\"name\": \"%s\", \"eager\": %s, \"hybrid\": %s, \"ways\": %llu, \"nodes\": %" PRIu64
+                ", \"accesses\": %" PRIu64 ", \"seconds\": %.6f, \"accesses_per_sec\": %.0f, \"ns_per_access\": %.2f"
+                ", \"peak_rss_kb\": %ld, \"cache_accesses\": %" PRIu64 ", \"hits\": %" PRIu64
+                ", \"dram_accesses\": %" PRIu64 "}",
+                k ? ",\n" : "", name, bc->eager ? "true" : "false", bc->hybrid ? "true" : "false", 1ULL << bc->s, bc->num_nodes,
+                result.accesses, result.seconds, result.accesses / result.seconds,
+                result.seconds * 1e9 / result.accesses, peak_rss, result.cache_accesses, result.hits,
+                result.dram_accesses);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return ret;
+}
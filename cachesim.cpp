@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <cmath>
@@ -7,102 +8,564 @@
 
 #include "cachesim.hpp"
 
-std::vector<uint64_t> lv_addr_offset;
-uint64_t total_levels;
-// TODO: Make this per block
-bool single_owner = false;
-bool hybrid_coh = false;
-uint64_t write_thresh = 0;
-static int64_t sim_verify_access(cache_t *cache, uint64_t node_id, uint32_t level, uint64_t pfn, sim_stats_t *stats, bool eager,bool rw);
+// Work list entries allocated up front. The list lives on the heap and is not bounded: a propagation can
+// evict a dirty block of a lower level and start another one, so no tree geometry limits the cascade
+// depth. Longer cascades grow the list, they never deepen the call stack.
+static const uint64_t TREE_WALK_RESERVE = 1024;
+
+// How the nodes keep their caches coherent, fixed for a whole run
+typedef enum {
+    COH_NONE,                       // A single node snooping, it never has sharers
+    COH_SNOOP,
+    COH_DIRECTORY,
+} coh_kind_t;
+
+// Update and coherence policies of a run as compile-time constants, so the cache access kernels are
+// instantiated without the branches and sharer lookups of the other policies
+template <bool EAGER, coh_kind_t COH>
+struct sim_mode {
+    static const bool eager = EAGER;
+    static const coh_kind_t coh = COH;
+};
+
+template <unsigned ARITY, typename POLICY, bool WARM, typename MODE>
+static int64_t sim_verify_access(sim_t *sim, uint64_t node_id, uint64_t pfn, bool rw);
+static void sharers_setup(sharer_table_t *table, uint64_t min_slots);
+static void dir_setup(directory_t *dir, uint64_t min_entries, uint64_t idx_bits);
+
+// Common arities walk the tree with constant shifts
+template <unsigned ARITY, typename POLICY, typename MODE>
+static void sim_set_walks(sim_t *sim) {
+    sim->verify = sim_verify_access<ARITY, POLICY, false, MODE>;
+    sim->warm = sim_verify_access<ARITY, POLICY, true, MODE>;
+}
+
+template <typename POLICY, typename MODE>
+static bool sim_walk_level(sim_t *sim, uint64_t node_id, uint64_t metadata_pfn, uint64_t pfn, uint64_t level, bool rw);
+
+template <typename POLICY, typename MODE>
+static void sim_set_arity(sim_t *sim) {
+    sim->walk_level = sim_walk_level<POLICY, MODE>;
+    switch (sim->tree.arity) {
+    case 3: sim_set_walks<3, POLICY, MODE>(sim); break;
+    case 4: sim_set_walks<4, POLICY, MODE>(sim); break;
+    case 5: sim_set_walks<5, POLICY, MODE>(sim); break;
+    case 6: sim_set_walks<6, POLICY, MODE>(sim); break;
+    default: sim_set_walks<0, POLICY, MODE>(sim); break;
+    }
+}
+
+template <typename POLICY, coh_kind_t COH>
+static void sim_set_mode(sim_t *sim) {
+    if (sim->config.eager) {
+        sim_set_arity<POLICY, sim_mode<true, COH>>(sim);
+    } else {
+        sim_set_arity<POLICY, sim_mode<false, COH>>(sim);
+    }
+}
+
+/**
+ * @brief Pick the tree walk instantiated for the replacement policy, update and coherence policies and
+ * arity of the simulation
+ */
+template <typename POLICY>
+static void sim_set_verify(sim_t *sim) {
+    if (sim->directory) {
+        sim_set_mode<POLICY, COH_DIRECTORY>(sim);
+    } else if (sim->num_nodes > 1) {
+        sim_set_mode<POLICY, COH_SNOOP>(sim);
+    } else {
+        sim_set_mode<POLICY, COH_NONE>(sim);
+    }
+}
+
 /**
- * @brief Subroutine for initializing the cache simulator. You many add and initialize any global or heap
- * variables as needed.
+ * @brief Subroutine for initializing the cache simulator. Everything a simulation needs is owned by sim,
+ * so independent simulators can run concurrently on separate threads.
  * 
  * @param config Simulation config
  */
 
-void sim_setup(cache_t *cache_core, sim_config_t *config) {
-    ULL lv_size = MAX_MEM_SIZE / (1ULL << CPU_CACHE_BLOCK_SIZE);
-    for (int i=0; i<NUM_NODES; i++){
+void sim_setup(sim_t *sim, sim_config_t *config) {
+    assert(config->num_nodes >= 1 && config->num_nodes <= MAX_NODES);
+    sim->num_nodes = config->num_nodes;
+    sim->cache.assign(sim->num_nodes, cache_t());
+    sim->stats.assign(sim->num_nodes, sim_stats_t());
+    sim->hist.assign(sim->num_nodes, sim_hist_t());
+    cache_t *cache_core = sim->cache.data();
+    sim->config = *config;
+    // TODO: Make this per block
+    sim->single_owner = config->single_owner;
+    sim->hybrid_coh = config->hybrid_coh;
+    sim->write_thresh = config->hybrid_coh ? config->write_thresh : 0;
+    sim->directory = config->directory;
+    for (uint64_t i=0; i<sim->num_nodes; i++){
         cache_core[i].c = config->c;
-        cache_core[i].b = 6;
+        cache_core[i].b = METADATA_BLOCK_SIZE;
         cache_core[i].s = config->s;
 	cache_core[i].eager = config->eager;
-		if(cache_core[i].eager){
-			std::cout<<"eager"<<std::endl;
-		}
-		else{
-			std::cout<<"lazy"<<std::endl;
-
-		}
         cache_core[i].idx = config->c - config->s - cache_core[i].b;
-        cache_core[i].cache = new std::map<uint64_t, cache_entry_t>[1 << cache_core[i].idx];
-        cache_core[i].lruQ = new std::list<uint64_t>[1 << cache_core[i].idx];
-        cache_core[i].set_entries = new uint64_t[1 << cache_core[i].idx]();
+        uint64_t num_blocks = (1ULL << cache_core[i].idx) << cache_core[i].s;
+        cache_core[i].tags = new uint64_t[num_blocks];
+        std::fill_n(cache_core[i].tags, num_blocks, INVALID_TAG);
+        cache_core[i].match = tag_match_kernel(config->tag_match, 1ULL << cache_core[i].s);
+        cache_core[i].blocks = new cache_entry_t[num_blocks]();
+        cache_core[i].repl = new uint64_t[num_blocks]();
+        cache_core[i].repl_clock = 0;
+        cache_core[i].set_entries = new uint64_t[1ULL << cache_core[i].idx]();
         cache_core[i].tag_compare_time = L1_TAG_COMPARE_TIME_CONST + L1_TAG_COMPARE_TIME_PER_S * (cache_core[i].s);
     }
-    total_levels = ceil(log2(lv_size) * 1.0/log2(8));
-    std::cout << log2(lv_size) << " " << total_levels << std::endl;
-    lv_addr_offset.resize(total_levels);
-    lv_addr_offset[0] = 0xfffffff000000000;
-    lv_size >>= BLOCKS_PER_TOC_NODE;
-    for (uint64_t i = 1; i < total_levels; ++i, lv_size >>= BLOCKS_PER_TOC_NODE) {
-        lv_addr_offset[i] = lv_addr_offset[i - 1] + lv_size;
+    // A block can be resident in every node at most once, keep the table at most half full
+    uint64_t max_resident = sim->num_nodes * ((1ULL << cache_core[0].idx) << cache_core[0].s);
+    sim->sharers.entries = NULL;
+    sim->dir.entries = NULL;
+    if (sim->directory) {
+        dir_setup(&sim->dir, config->dir_size ? 1ULL << config->dir_size : 2 * max_resident, cache_core[0].idx);
+    } else {
+        sharers_setup(&sim->sharers, 2 * max_resident);
+    }
+    tree_setup(&sim->tree, config);
+    sim->timing = NULL;
+    if (config->timing) {
+        double hit_time = L1_ARRAY_LOOKUP_TIME_CONST + cache_core[0].tag_compare_time;
+        sim->timing = timing_setup(config, (uint64_t)ceil(hit_time));
     }
-    single_owner = config->single_owner;
-    if (config->hybrid_coh) {
-        hybrid_coh = true;
-        write_thresh = config->write_thresh;
-        std::cout << write_thresh << std::endl;
+    switch (config->repl) {
+    case REPL_PLRU: sim_set_verify<repl_plru>(sim); break;
+    case REPL_SRRIP: sim_set_verify<repl_srrip>(sim); break;
+    case REPL_BRRIP: sim_set_verify<repl_brrip>(sim); break;
+    case REPL_LEVEL: sim_set_verify<repl_level>(sim); break;
+    default: sim_set_verify<repl_lru>(sim); break;
     }
+    sim->walks.reserve(TREE_WALK_RESERVE);
+    sim->spawned.reserve(MAX_NODES + 1);
 #ifdef DEBUG
-    for (uint64_t i = 0; i < total_levels; ++i) {
-        std::cout << "INIT: Level[" << i << "] offset: " << std::hex << lv_addr_offset[i] << std::endl;
+    for (uint64_t i = 0; i < sim->tree.total_levels; ++i) {
+        std::cout << "INIT: Level[" << i << "] offset: " << std::hex << sim->tree.lv_addr_offset[i] << std::endl;
     }
 #endif
 }
 
-//coh_state_t snoop_cache(cache_t *cache, uint64_t node_id, uint64_t pfn, uint64_t orig_pfn){
-coh_state_t snoop_cache(cache_t *cache, uint64_t node_id, uint64_t idx, uint64_t tag){
-    //uint64_t idx = pfn % (1 << cache[node_id].idx);
-    //uint64_t tag = pfn >> cache[node_id].idx;
-    if (cache[node_id].cache[idx][tag].valid) {
-        return cache[node_id].cache[idx][tag].coh_state;
+/**
+ * @brief Number of integrity tree levels, the root included, covering the protected memory
+ */
+uint64_t tree_levels(const sim_config_t *config) {
+    uint64_t leaf_blocks = config->mem_size - config->block_size;
+    return (leaf_blocks + config->arity - 1) / config->arity;
+}
+
+/**
+ * @brief Check that a tree geometry can be simulated
+ *
+ * @return NULL if it can, otherwise what is wrong with it
+ */
+const char *tree_check(const sim_config_t *config) {
+    if (config->arity == 0) {
+        return "Tree nodes need at least 2 children";
+    }
+    if (config->arity > MAX_TREE_ARITY) {
+        return "Tree nodes have at most 2^16 children";
+    }
+    if (config->mem_size <= config->block_size) {
+        return "Protected memory must be larger than a block";
+    }
+    if (config->arity >= config->mem_size - config->block_size) {
+        return "Tree nodes need fewer children than there are leaf blocks";
+    }
+    if (tree_levels(config) > MAX_TREE_LEVELS) {
+        return "Too many tree levels";
+    }
+    if (config->pin_levels >= tree_levels(config)) {
+        return "More pinned levels than tree levels below the root";
+    }
+    // Metadata pfns of all levels are placed below 2^64 from TREE_BASE_PFN on
+    if (config->mem_size - config->block_size >= TREE_PFN_SPACE + config->arity) {
+        return "Protected memory too large for the tree address space";
+    }
+    return NULL;
+}
+
+void tree_setup(tree_geometry_t *tree, const sim_config_t *config) {
+    assert(tree_check(config) == NULL);
+    tree->arity = config->arity;
+    tree->block_size = config->block_size;
+    tree->total_levels = tree_levels(config);
+    tree->pin_level = tree->total_levels - 1 - config->pin_levels;
+    tree->pfn_mask = (1ULL << (config->mem_size - config->block_size)) - 1;
+    tree->lv_addr_offset = new uint64_t[tree->total_levels];
+    ULL lv_size = 1ULL << (config->mem_size - config->block_size);
+    tree->lv_addr_offset[0] = TREE_BASE_PFN;
+    lv_size >>= tree->arity;
+    for (uint64_t i = 1; i < tree->total_levels; ++i, lv_size >>= tree->arity) {
+        tree->lv_addr_offset[i] = tree->lv_addr_offset[i - 1] + lv_size;
+    }
+}
+
+/**
+ * @brief Metadata blocks of the levels held in the pinned buffer, every block of those levels
+ */
+uint64_t tree_pinned_blocks(const tree_geometry_t *tree) {
+    uint64_t blocks = 0;
+    for (uint64_t level = tree->pin_level; level < tree->total_levels - 1; level++) {
+        uint64_t shift = (level + 1) * tree->arity;
+        blocks += shift < 64 ? (tree->pfn_mask >> shift) + 1 : 1;
+    }
+    return blocks;
+}
+
+void tree_free(tree_geometry_t *tree) {
+    delete[] tree->lv_addr_offset;
+}
+
+static inline uint64_t sharers_home(const sharer_table_t *table, uint64_t pfn) {
+    return (pfn * 0x9e3779b97f4a7c15ULL >> 32) & table->mask;
+}
+
+static void sharers_setup(sharer_table_t *table, uint64_t min_slots) {
+    uint64_t slots = 1;
+    while (slots < min_slots) {
+        slots <<= 1;
+    }
+    table->mask = slots - 1;
+    table->entries = new sharer_entry_t[slots];
+    for (uint64_t i = 0; i < slots; i++) {
+        table->entries[i].pfn = INVALID_TAG;
+        table->entries[i].nodes = 0;
+    }
+}
+
+/**
+ * @brief Find the slot of a block in the sharer table
+ *
+ * @return The slot holding pfn, or the free slot where it would be inserted
+ */
+static inline uint64_t sharers_find(const sharer_table_t *table, uint64_t pfn) {
+    uint64_t i = sharers_home(table, pfn);
+    while (table->entries[i].pfn != pfn && table->entries[i].pfn != INVALID_TAG) {
+        i = (i + 1) & table->mask;
+    }
+    return i;
+}
+
+static void dir_setup(directory_t *dir, uint64_t min_entries, uint64_t idx_bits) {
+    uint64_t entries = DIR_WAYS;
+    while (entries < min_entries) {
+        entries <<= 1;
+    }
+    dir->set_mask = entries / DIR_WAYS - 1;
+    dir->idx_bits = idx_bits;
+    dir->lru_clock = 0;
+    dir->entries = new dir_entry_t[entries];
+    for (uint64_t i = 0; i < entries; i++) {
+        dir->entries[i].pfn = INVALID_TAG;
+        dir->entries[i].sharers = 0;
+        dir->entries[i].owner = DIR_NO_OWNER;
+        dir->entries[i].state = COH_STATE_INVAL;
+        dir->entries[i].lru = 0;
+    }
+}
+
+/**
+ * @brief Directory set of a block. A directory with more sets than a cache takes the cache set index as
+ * the low bits and hashes the tag into the others, a smaller one hashes the cache set index. Either way a
+ * directory set only holds blocks of the cache sets mapped to it, which the sharded engine owns together.
+ */
+uint64_t dir_set_index(const directory_t *dir, uint64_t pfn) {
+    uint64_t idx = pfn & ((1ULL << dir->idx_bits) - 1);
+    if ((dir->set_mask >> dir->idx_bits) == 0) {
+        return (idx * 0x9e3779b97f4a7c15ULL >> 32) & dir->set_mask;
+    }
+    uint64_t hash = (pfn >> dir->idx_bits) * 0x9e3779b97f4a7c15ULL >> 32;
+    return (hash << dir->idx_bits | idx) & dir->set_mask;
+}
+
+static inline dir_entry_t *dir_set(const directory_t *dir, uint64_t pfn) {
+    return dir->entries + dir_set_index(dir, pfn) * DIR_WAYS;
+}
+
+/**
+ * @brief Find the directory entry of a block
+ *
+ * @return The entry, or NULL if no node holds the block
+ */
+static inline dir_entry_t *dir_find(const directory_t *dir, uint64_t pfn) {
+    dir_entry_t *set = dir_set(dir, pfn);
+    for (uint64_t way = 0; way < DIR_WAYS; way++) {
+        if (set[way].pfn == pfn) {
+            return &set[way];
+        }
     }
-    return COH_STATE_INVAL;
+    return NULL;
 }
 
-bool inval_block(cache_t *cache, uint64_t node_id, uint64_t idx, uint64_t tag){
-    cache[node_id].cache[idx][tag].valid = false;
-    cache[node_id].cache[idx][tag].dirty = false;
-    cache[node_id].cache[idx][tag].single_owner = false;
-    cache[node_id].cache[idx][tag].coh_state=COH_STATE_INVAL;
+static void dir_remove(directory_t *dir, uint64_t pfn, uint64_t node_id) {
+    dir_entry_t *entry = dir_find(dir, pfn);
+    assert(entry);
+    entry->sharers &= ~(1ULL << node_id);
+    if (entry->owner == node_id) {
+        entry->owner = DIR_NO_OWNER;
+    }
+    if (entry->sharers == 0) {
+        entry->pfn = INVALID_TAG;
+        entry->state = COH_STATE_INVAL;
+    }
+}
+
+// Nodes other than node_id holding pfn
+template <typename MODE>
+static inline uint64_t other_sharers(const sim_t *sim, uint64_t pfn, uint64_t node_id) {
+    uint64_t nodes;
+    if (MODE::coh == COH_NONE) {
+        return 0;
+    }
+    if (MODE::coh == COH_DIRECTORY) {
+        const dir_entry_t *entry = dir_find(&sim->dir, pfn);
+        nodes = entry ? entry->sharers : 0;
+    } else {
+        nodes = sim->sharers.entries[sharers_find(&sim->sharers, pfn)].nodes;
+    }
+    return nodes & ~(1ULL << node_id);
+}
+
+static inline void sharers_add(sharer_table_t *table, uint64_t pfn, uint64_t node_id) {
+    sharer_entry_t *entry = &table->entries[sharers_find(table, pfn)];
+    entry->pfn = pfn;
+    entry->nodes |= 1ULL << node_id;
+}
+
+static void sharers_remove(sharer_table_t *table, uint64_t pfn, uint64_t node_id) {
+    uint64_t i = sharers_find(table, pfn);
+    assert(table->entries[i].pfn == pfn);
+    table->entries[i].nodes &= ~(1ULL << node_id);
+    if (table->entries[i].nodes) {
+        return;
+    }
+    // Last sharer gone, shift the rest of the probe run back over the free slot
+    for (uint64_t j = (i + 1) & table->mask; table->entries[j].pfn != INVALID_TAG; j = (j + 1) & table->mask) {
+        uint64_t home = sharers_home(table, table->entries[j].pfn);
+        if (((j - home) & table->mask) >= ((j - i) & table->mask)) {
+            table->entries[i] = table->entries[j];
+            i = j;
+        }
+    }
+    table->entries[i].pfn = INVALID_TAG;
+    table->entries[i].nodes = 0;
+}
+
+// node_id no longer holds pfn
+template <typename MODE>
+static inline void remove_sharer(sim_t *sim, uint64_t pfn, uint64_t node_id) {
+    if (MODE::coh == COH_DIRECTORY) {
+        dir_remove(&sim->dir, pfn, node_id);
+    } else if (MODE::coh == COH_SNOOP) {
+        sharers_remove(&sim->sharers, pfn, node_id);
+    }
+}
+
+/**
+ * @brief Find the way of set idx holding tag
+ *
+ * @return Way number, or -1 if the block is not resident
+ */
+static inline int64_t find_way(const cache_t *cache, uint64_t idx, uint64_t tag) {
+    return cache->match(cache->tags + (idx << cache->s), 1ULL << cache->s, tag);
+}
+
+/**
+ * @brief Pick the way to fill in set idx: a free way if there is one, the policy's victim otherwise
+ */
+template <typename POLICY>
+static inline uint64_t find_victim(cache_t *cache, uint64_t idx) {
+    uint64_t ways = 1ULL << cache->s;
+    uint64_t base = idx << cache->s;
+    if (cache->set_entries[idx] < ways) {
+        return cache->match(cache->tags + base, ways, INVALID_TAG);
+    }
+    return POLICY::victim(cache->repl + base, ways, &cache->repl_clock);
+}
+
+template <typename POLICY>
+static inline void touch_way(cache_t *cache, uint64_t idx, uint64_t way) {
+    POLICY::touch(cache->repl + (idx << cache->s), 1ULL << cache->s, way, &cache->repl_clock);
+}
+
+template <typename POLICY>
+static inline void fill_way(cache_t *cache, uint64_t idx, uint64_t way, uint64_t level) {
+    POLICY::fill(cache->repl + (idx << cache->s), 1ULL << cache->s, way, level, &cache->repl_clock);
+}
+
+/**
+ * @brief Look up a block in a cache. Never allocates or changes any state, so it is safe
+ * to use for probing remote nodes.
+ *
+ * @return Block state, or NULL if the block is not resident
+ */
+cache_entry_t *cache_probe(cache_t *cache, uint64_t idx, uint64_t tag) {
+    int64_t way = find_way(cache, idx, tag);
+    if (way < 0) {
+        return NULL;
+    }
+    return &cache->blocks[(idx << cache->s) + way];
+}
+
+//coh_state_t snoop_cache(cache_t *cache, uint64_t node_id, uint64_t pfn, uint64_t orig_pfn){
+cache_entry_t *snoop_cache(cache_t *cache, uint64_t node_id, uint64_t idx, uint64_t tag){
+    return cache_probe(&cache[node_id], idx, tag);
+}
+
+static inline coh_state_t snoop_state(const cache_entry_t *blk) {
+    return blk ? blk->coh_state : COH_STATE_INVAL;
+}
+
+// blk must be a resident block of set idx of the node, as returned by cache_probe
+template <typename MODE>
+static bool inval_block(sim_t *sim, uint64_t node_id, uint64_t idx, cache_entry_t *blk){
+    cache_t *cache = sim->cache.data();
+    uint64_t slot = blk - cache[node_id].blocks;
+    assert((slot >> cache[node_id].s) == idx);
+    remove_sharer<MODE>(sim, (cache[node_id].tags[slot] << cache[node_id].idx) | idx, node_id);
+    cache[node_id].tags[slot] = INVALID_TAG;
+    *blk = cache_entry_t();
+    blk->coh_state = COH_STATE_INVAL;
     cache[node_id].set_entries[idx]--;
-    cache[node_id].cache[idx][tag].num_reads = 0;
-    cache[node_id].cache[idx][tag].num_writes = 0;
-    cache[node_id].cache[idx][tag].num_transfers = 0;
-    cache[node_id].lruQ[idx].remove(tag);
     return true;
 }
 
-int maybe_mark_block_single_owner(cache_t *cache, uint64_t node_id, uint64_t idx, uint64_t tag, sim_stats_t* stats) {
-    if (!hybrid_coh) {
+// Count a DRAM writeback of node_id, also in the total of all nodes the timing model reads
+static inline void count_dram_write(sim_t *sim, uint64_t node_id) {
+    sim->stats[node_id].num_dram_writes++;
+    if (sim->timing) {
+        sim->timing->dram_writes++;
+    }
+}
+
+// Dirty block invalidated by a directory eviction, written back once the access that caused it is done
+typedef struct dir_writeback {
+    uint64_t node_id;
+    uint64_t orig_pfn;
+    uint64_t block_lvl;
+} dir_writeback_t;
+
+/**
+ * @brief Account for a request of node_id reaching the directory. Every request costs the request and
+ * the directory reply, plus a forward or invalidation and its ack or data for each contacted sharer.
+ */
+template <bool WARM>
+static inline void dir_request(sim_t *sim, uint64_t node_id, uint64_t pfn, uint64_t contacted) {
+    sim_stats_t *stats = sim->stats.data();
+    if (!WARM) {
+        stats[node_id].num_dir_lookups++;
+        stats[node_id].num_dir_msgs += 2 + 2 * contacted;
+    }
+    dir_entry_t *entry = dir_find(&sim->dir, pfn);
+    if (entry) {
+        entry->lru = ++sim->dir.lru_clock;
+    }
+}
+
+/**
+ * @brief Allocate the directory entry of a block, replacing the LRU entry of its set if the set is full.
+ * The block of the replaced entry is invalidated in every sharer, dirty copies are written back and
+ * returned in wb for the caller to propagate up the tree.
+ */
+template <bool WARM>
+static dir_entry_t *dir_alloc(sim_t *sim, uint64_t node_id, uint64_t pfn, dir_writeback_t *wb, uint64_t *num_wb) {
+    cache_t *cache = sim->cache.data();
+    sim_stats_t *stats = sim->stats.data();
+    dir_entry_t *set = dir_set(&sim->dir, pfn);
+    dir_entry_t *victim = set;
+    for (uint64_t way = 0; way < DIR_WAYS; way++) {
+        if (set[way].pfn == INVALID_TAG) {
+            victim = &set[way];
+            break;
+        }
+        if (set[way].lru < victim->lru) {
+            victim = &set[way];
+        }
+    }
+    if (victim->pfn != INVALID_TAG) {
+        uint64_t idx = victim->pfn & ((1ULL << cache[0].idx) - 1);
+        uint64_t tag = victim->pfn >> cache[0].idx;
+        if (!WARM) {
+            stats[node_id].num_dir_evictions++;
+            stats[node_id].num_dir_msgs += 2 * __builtin_popcountll(victim->sharers);
+        }
+        // Invalidating the last sharer frees the entry
+        for (uint64_t sharers = victim->sharers; sharers; sharers &= sharers - 1) {
+            uint64_t i = __builtin_ctzll(sharers);
+            cache_entry_t *rblk = cache_probe(&cache[i], idx, tag);
+            assert(rblk);
+            if (rblk->dirty) {
+                if (!WARM) {
+                    ++stats[i].num_dram_accesses;
+                    count_dram_write(sim, i);
+                    stats[i].writebacks_l1++;
+                    stats[i].level[rblk->block_lvl].dirty_evictions++;
+                }
+                wb[*num_wb].node_id = i;
+                wb[*num_wb].orig_pfn = rblk->orig_pfn;
+                wb[*num_wb].block_lvl = rblk->block_lvl;
+                (*num_wb)++;
+            }
+            inval_block<sim_mode<false, COH_DIRECTORY>>(sim, i, idx, rblk);
+        }
+        assert(victim->pfn == INVALID_TAG);
+    }
+    victim->pfn = pfn;
+    victim->sharers = 0;
+    victim->owner = DIR_NO_OWNER;
+    victim->state = COH_STATE_INVAL;
+    victim->lru = ++sim->dir.lru_clock;
+    return victim;
+}
+
+template <bool WARM>
+static inline void dir_add(sim_t *sim, uint64_t node_id, uint64_t pfn, dir_writeback_t *wb, uint64_t *num_wb) {
+    dir_entry_t *entry = dir_find(&sim->dir, pfn);
+    if (entry == NULL) {
+        entry = dir_alloc<WARM>(sim, node_id, pfn, wb, num_wb);
+    }
+    entry->sharers |= 1ULL << node_id;
+}
+
+// Record the state node_id left the block in after its access
+static inline void dir_set_state(sim_t *sim, uint64_t node_id, uint64_t pfn, coh_state_t state) {
+    dir_entry_t *entry = dir_find(&sim->dir, pfn);
+    assert(entry);
+    entry->state = state;
+    if (state == COH_STATE_MODIFIED || state == COH_STATE_EXCLUSIVE) {
+        entry->owner = node_id;
+    } else {
+        entry->owner = DIR_NO_OWNER;
+    }
+}
+
+template <typename MODE>
+static inline int maybe_mark_block_single_owner(sim_t *sim, uint64_t node_id, uint64_t idx, uint64_t tag,
+                                                cache_entry_t *blk) {
+    cache_t *cache = sim->cache.data();
+    uint64_t pfn = (tag << cache[node_id].idx) | idx;
+    if (!sim->hybrid_coh) {
         return 0;
     }
-    if (!cache[node_id].cache[idx][tag].valid || cache[node_id].cache[idx][tag].coh_state == COH_STATE_INVAL) {
+    if (blk->coh_state == COH_STATE_INVAL) {
         return 0;
     }
-    if (cache[node_id].cache[idx][tag].num_writes >= write_thresh) { //cache[node_id].cache[idx][tag].num_writes * 1.0/cache[node_id].cache[idx][tag].num_reads > 0.5) {
-        if (!cache[node_id].cache[idx][tag].single_owner) {
-            cache[node_id].cache[idx][tag].single_owner = true;
-            for(uint64_t i=0; i<NUM_NODES;i++){
-                if(i!=node_id){
-                    if(snoop_cache( cache,i,idx,tag) != COH_STATE_INVAL){
-                        inval_block(cache,i,idx,tag);
-                        //increment for every block that is actually invalidated?
-                        //  or broadcast to everyone if not in EX or MOD state?
-                        //stats[node_id].num_inval_msgs++;
-                    }
+    if (blk->num_writes >= sim->write_thresh) { //blk->num_writes * 1.0/blk->num_reads > 0.5) {
+        if (!blk->single_owner) {
+            blk->single_owner = true;
+            uint64_t others = other_sharers<MODE>(sim, pfn, node_id);
+            if (MODE::coh == COH_DIRECTORY && others) {
+                dir_request<false>(sim, node_id, pfn, __builtin_popcountll(others));
+            }
+            for(uint64_t sharers = others; sharers; sharers &= sharers - 1){
+                uint64_t i = __builtin_ctzll(sharers);
+                cache_entry_t *rblk = snoop_cache(cache,i,idx,tag);
+                if(rblk){
+                    inval_block<MODE>(sim,i,idx,rblk);
+                    //increment for every block that is actually invalidated?
+                    //  or broadcast to everyone if not in EX or MOD state?
+                    //stats[node_id].num_inval_msgs++;
                 }
             }
             return 1;
@@ -112,7 +575,7 @@ int maybe_mark_block_single_owner(cache_t *cache, uint64_t node_id, uint64_t idx
             cache[node_id].cache[idx][tag].single_owner = false;
             // it's in M state, so no one else can have it anyways
             // so extra invals
-            for(uint64_t i=0; i<NUM_NODES;i++){
+            for(uint64_t i=0; i<sim->num_nodes;i++){
                 if(i!=node_id){
                     cache[i].cache[idx][tag].single_owner = false;
                 }
@@ -130,38 +593,60 @@ int maybe_mark_block_single_owner(cache_t *cache, uint64_t node_id, uint64_t idx
  * @param addr Address to access
  * @param rw 0 for Read or 1 for Write
  * @param stats Simulation stats
+ * @tparam WARM Functional warming: tags, replacement and coherence state change as in a full access but
+ * statistics are not counted and blocks are never promoted to single owner
+ * @tparam MODE Update and coherence policies, a sim_mode
  */
-bool sim_access_cache(cache_t *cache, uint64_t node_id, uint64_t pfn, bool rw, sim_stats_t* stats, bool eager,
-                      uint64_t orig_pfn, uint32_t level) {
+template <typename POLICY, bool WARM, typename MODE>
+static bool sim_access_cache(sim_t *sim, uint64_t node_id, uint64_t pfn, bool rw, uint64_t orig_pfn,
+                             uint32_t level) {
+    cache_t *cache = sim->cache.data();
+    sim_stats_t *stats = sim->stats.data();
     bool res = true;
-    uint64_t idx = pfn % (1 << cache[node_id].idx);
+    uint64_t idx = pfn & ((1ULL << cache[node_id].idx) - 1);
     uint64_t tag = pfn >> cache[node_id].idx;
-    stats[node_id].accesses_l1++;
-    if (rw == READ) {
-        stats[node_id].eff_reads++;
-    } else {
-        stats[node_id].eff_writes++;
+    if (!WARM) {
+        stats[node_id].accesses_l1++;
+        stats[node_id].level[level].accesses++;
+        if (rw == READ) {
+            stats[node_id].eff_reads++;
+        } else {
+            stats[node_id].eff_writes++;
+        }
     }
-    if (cache[node_id].cache[idx][tag].valid) {
+    int64_t way = find_way(&cache[node_id], idx, tag);
+    if (way >= 0) {
         // hit
-        stats[node_id].hits_l1++;
+        uint64_t slot = (idx << cache[node_id].s) + way;
+        cache_entry_t *blk = &cache[node_id].blocks[slot];
+        if (!WARM) {
+            stats[node_id].hits_l1++;
+            stats[node_id].level[level].hits++;
+        }
         if (rw == WRITE){
-            cache[node_id].cache[idx][tag].dirty = true;
-            cache[node_id].cache[idx][tag].coh_state = COH_STATE_MODIFIED;
-            cache[node_id].cache[idx][tag].num_writes++;
-            cache[node_id].cache[idx][tag].orig_pfn=orig_pfn;
-            cache[node_id].cache[idx][tag].block_lvl=level;
+            uint64_t others = other_sharers<MODE>(sim, pfn, node_id);
+            // Writes to a shared block upgrade through the directory, E and M are upgraded silently
+            if (MODE::coh == COH_DIRECTORY && blk->coh_state == COH_STATE_SHARED) {
+                dir_request<WARM>(sim, node_id, pfn, __builtin_popcountll(others));
+            }
+            blk->dirty = true;
+            blk->coh_state = COH_STATE_MODIFIED;
+            blk->num_writes++;
+            blk->orig_pfn=orig_pfn;
+            blk->block_lvl=level;
             //COHERENCE ACTION for HIT WRITE (invalidate everyone else)
-            for(uint64_t i=0; i<NUM_NODES;i++){
-                if(i!=node_id){
-                    if(snoop_cache( cache,i,idx,tag) != COH_STATE_INVAL){
-                        if (cache[node_id].cache[idx][tag].single_owner) {
-                            std::cerr << "WARNING - invalid coherence state with single ownership" << "(" << i << ","  << idx << "," << tag << ")\n";
-                            assert(false);
-                        }
-                        inval_block(cache,i,idx,tag);
-                        //increment for every block that is actually invalidated?
-                        //  or broadcast to everyone if not in EX or MOD state?
+            for(uint64_t sharers = others; sharers; sharers &= sharers - 1){
+                uint64_t i = __builtin_ctzll(sharers);
+                cache_entry_t *rblk = snoop_cache(cache,i,idx,tag);
+                if(rblk){
+                    if (blk->single_owner) {
+                        std::cerr << "WARNING - invalid coherence state with single ownership" << "(" << i << ","  << idx << "," << tag << ")\n";
+                        assert(false);
+                    }
+                    inval_block<MODE>(sim,i,idx,rblk);
+                    //increment for every block that is actually invalidated?
+                    //  or broadcast to everyone if not in EX or MOD state?
+                    if (!WARM) {
                         stats[node_id].num_inval_msgs++;
                     }
                 }
@@ -171,310 +656,430 @@ bool sim_access_cache(cache_t *cache, uint64_t node_id, uint64_t pfn, bool rw, s
         else{
             //COHERENCE ACTION for read hit
             //None of this should execute if it's a hit..?
-            cache[node_id].cache[idx][tag].num_reads++;
+            blk->num_reads++;
             uint64_t sharers_tmp=0;
-            for(uint64_t i=0; i<NUM_NODES;i++){
-                if(i!=node_id){
-                    coh_state_t cstate = snoop_cache( cache,i,idx,tag);
-                    if (cache[node_id].cache[idx][tag].single_owner && cstate != COH_STATE_INVAL) {
-                        std::cerr << "WARNING - invalid coherence state with single ownership" << "(" << i << ","  << idx << "," << tag << ")\n";
-                        assert(false);
-                    }
-                    if(cstate!=COH_STATE_INVAL){
-                        sharers_tmp++;
-                    }
-                    if(cstate==COH_STATE_EXCLUSIVE){
-                        std::cerr<<"WARNING - cache hit but another node was in exclusive"<<std::endl;
-                        cache[i].cache[idx][tag].coh_state=COH_STATE_SHARED;
-                    }
-                    if(cstate==COH_STATE_MODIFIED){
-                        std::cerr<<"WARNING - cache hit but another node was in modified"<<std::endl;
-                        cache[i].cache[idx][tag].coh_state=COH_STATE_SHARED;
-                        cache[i].cache[idx][tag].dirty=false;
+            for(uint64_t sharers = other_sharers<MODE>(sim, pfn, node_id); sharers; sharers &= sharers - 1){
+                uint64_t i = __builtin_ctzll(sharers);
+                cache_entry_t *rblk = snoop_cache(cache,i,idx,tag);
+                coh_state_t cstate = snoop_state(rblk);
+                if (blk->single_owner && cstate != COH_STATE_INVAL) {
+                    std::cerr << "WARNING - invalid coherence state with single ownership" << "(" << i << ","  << idx << "," << tag << ")\n";
+                    assert(false);
+                }
+                if(cstate!=COH_STATE_INVAL){
+                    sharers_tmp++;
+                }
+                if(cstate==COH_STATE_EXCLUSIVE){
+                    std::cerr<<"WARNING - cache hit but another node was in exclusive"<<std::endl;
+                    rblk->coh_state=COH_STATE_SHARED;
+                }
+                if(cstate==COH_STATE_MODIFIED){
+                    std::cerr<<"WARNING - cache hit but another node was in modified"<<std::endl;
+                    rblk->coh_state=COH_STATE_SHARED;
+                    rblk->dirty=false;
+                    if (!WARM) {
                         stats[i].num_wb_from_m2s++;
                         //update writeback stat for the other node
                         stats[i].num_dram_accesses++;
-                        stats[i].num_dram_writes++;
+                        count_dram_write(sim, i);
                     }
                 }
             }
-            if(sharers_tmp==0) cache[node_id].cache[idx][tag].coh_state = COH_STATE_EXCLUSIVE;
-            else cache[node_id].cache[idx][tag].coh_state = COH_STATE_SHARED;
+            if(sharers_tmp==0) blk->coh_state = COH_STATE_EXCLUSIVE;
+            else blk->coh_state = COH_STATE_SHARED;
         }
-        auto it = std::find(cache[node_id].lruQ[idx].begin(), cache[node_id].lruQ[idx].end(), tag);
-        if (it != cache[node_id].lruQ[idx].end())
-            cache[node_id].lruQ[idx].remove(tag);
-        cache[node_id].lruQ[idx].push_back(tag);
-        int marked = maybe_mark_block_single_owner(cache, node_id, idx, tag, stats);
+        touch_way<POLICY>(&cache[node_id], idx, way);
+        int marked = WARM ? 0 : maybe_mark_block_single_owner<MODE>(sim, node_id, idx, tag, blk);
         if (marked > 0) {
             stats[node_id].num_single_owner_set++;
         } else if (marked < 0) {
             stats[node_id].num_single_owner_unset++;
         }
+        if (MODE::coh == COH_DIRECTORY) {
+            dir_set_state(sim, node_id, pfn, blk->coh_state);
+        }
         return res;
     }
     // miss
     res = false;
-    stats[node_id].misses_l1++;
+    if (!WARM) {
+        stats[node_id].misses_l1++;
+        stats[node_id].level[level].misses++;
+    }
+    // State of the incoming block, written into its way once coherence is resolved
+    cache_entry_t blk = cache_entry_t();
+    blk.orig_pfn = orig_pfn;
+    blk.block_lvl = level;
+    uint64_t others = other_sharers<MODE>(sim, pfn, node_id);
+    if (MODE::coh == COH_DIRECTORY) {
+        // A read is served by one sharer, a write invalidates all of them
+        dir_request<WARM>(sim, node_id, pfn, rw == WRITE ? __builtin_popcountll(others) : others != 0);
+    }
 
     //TODO - find in other caches
     // if found, change res=true
     //  take appropriate coherence action and increment block_transfer count
     if(rw==WRITE){
-        cache[node_id].cache[idx][tag].coh_state=COH_STATE_MODIFIED;
+        blk.coh_state=COH_STATE_MODIFIED;
         uint64_t prev_writes = 0, prev_reads = 0, prev_transfers = 0;
-        for(uint64_t i=0; i<NUM_NODES; i++){
-            if(i!=node_id){
-                coh_state_t cstate = snoop_cache(cache,i,idx,tag);
-                //TODO FILL THIS OUT
-                if(cstate!=COH_STATE_INVAL){
-                    res=true;
-                    if (cache[i].cache[idx][tag].single_owner) {
-                        // only one in non-inval state
-                        cache[node_id].cache[idx][tag].single_owner = true;
-                    }
-                    if (prev_writes == 0) {
-                        prev_writes = cache[i].cache[idx][tag].num_writes;
-                    }
-                    if (prev_reads == 0) {
-                        prev_reads = cache[i].cache[idx][tag].num_reads;
-                    }
-                    if (prev_transfers == 0) {
-                        prev_transfers = cache[i].cache[idx][tag].num_transfers;
-                    }
-                    inval_block(cache,i,idx,tag);
+        for(uint64_t sharers = others; sharers; sharers &= sharers - 1){
+            uint64_t i = __builtin_ctzll(sharers);
+            cache_entry_t *rblk = snoop_cache(cache,i,idx,tag);
+            //TODO FILL THIS OUT
+            if(rblk){
+                res=true;
+                if (rblk->single_owner) {
+                    // only one in non-inval state
+                    blk.single_owner = true;
+                }
+                if (prev_writes == 0) {
+                    prev_writes = rblk->num_writes;
+                }
+                if (prev_reads == 0) {
+                    prev_reads = rblk->num_reads;
+                }
+                if (prev_transfers == 0) {
+                    prev_transfers = rblk->num_transfers;
+                }
+                inval_block<MODE>(sim,i,idx,rblk);
+                if (!WARM) {
                     stats[node_id].num_inval_msgs++;
-                    cache[node_id].cache[idx][tag].coh_state=COH_STATE_MODIFIED;
                 }
+                blk.coh_state=COH_STATE_MODIFIED;
             }
         }
-		if(res){//the owner/forwarder didn't have to invalidate itself
+		if(res && !WARM){//the owner/forwarder didn't have to invalidate itself
 			stats[node_id].num_inval_msgs--;
 		}
-        cache[node_id].cache[idx][tag].num_writes = prev_writes + 1;
-        cache[node_id].cache[idx][tag].num_reads = prev_reads + 1;
-        if (res) cache[node_id].cache[idx][tag].num_transfers = prev_transfers + 1;
+        blk.num_writes = prev_writes + 1;
+        blk.num_reads = prev_reads + 1;
+        if (res) blk.num_transfers = prev_transfers + 1;
         //std::cout << prev_writes + 1 << "," << prev_reads + 1 << std::endl;
     }
     else{
-        cache[node_id].cache[idx][tag].coh_state=COH_STATE_EXCLUSIVE;
+        blk.coh_state=COH_STATE_EXCLUSIVE;
         uint64_t prev_writes = 0, prev_reads = 0, prev_transfers = 0;
-        for(uint64_t i=0; i<NUM_NODES; i++){
-            if(i!=node_id){
-                coh_state_t cstate = snoop_cache(cache,i,idx,tag);
-                if(cstate==COH_STATE_EXCLUSIVE){
-                    if (prev_writes == 0) {
-                        prev_writes = cache[i].cache[idx][tag].num_writes;
-                    }
-                    if (prev_reads == 0) {
-                        prev_reads = cache[i].cache[idx][tag].num_reads;
-                    }
-                    if (prev_transfers == 0) {
-                        prev_transfers = cache[i].cache[idx][tag].num_transfers;
-                    }
-                    res=true;
-                    ++cache[i].cache[idx][tag].num_reads;
-                    if (!cache[i].cache[idx][tag].single_owner) {
-                        cache[i].cache[idx][tag].coh_state=COH_STATE_SHARED;
-                        cache[node_id].cache[idx][tag].coh_state=COH_STATE_SHARED;
-                    }  else {
-                        inval_block(cache,i,idx,tag);
-                        //stats[node_id].num_inval_msgs++;
-                        cache[node_id].cache[idx][tag].coh_state=COH_STATE_EXCLUSIVE;
-                        cache[node_id].cache[idx][tag].single_owner = true;
-                    }
+        for(uint64_t sharers = others; sharers; sharers &= sharers - 1){
+            uint64_t i = __builtin_ctzll(sharers);
+            cache_entry_t *rblk = snoop_cache(cache,i,idx,tag);
+            coh_state_t cstate = snoop_state(rblk);
+            if(cstate==COH_STATE_EXCLUSIVE){
+                if (prev_writes == 0) {
+                    prev_writes = rblk->num_writes;
                 }
-                else if(cstate==COH_STATE_SHARED){
-                    if (prev_writes == 0) {
-                        prev_writes = cache[i].cache[idx][tag].num_writes;
-                    }
-                    if (prev_reads == 0) {
-                        prev_reads = cache[i].cache[idx][tag].num_reads;
-                    }
-                    if (prev_transfers == 0) {
-                        prev_transfers = cache[i].cache[idx][tag].num_transfers;
-                    }
-                    res=true;
-                    ++cache[i].cache[idx][tag].num_reads;
-                    if (!cache[i].cache[idx][tag].single_owner) {
-                        cache[i].cache[idx][tag].coh_state=COH_STATE_SHARED;
-                        cache[node_id].cache[idx][tag].coh_state=COH_STATE_SHARED;
-                    } else {
-                        inval_block(cache,i,idx,tag);
-                        //stats[node_id].num_inval_msgs++;
-                        cache[node_id].cache[idx][tag].coh_state=COH_STATE_EXCLUSIVE;
-                        cache[node_id].cache[idx][tag].single_owner = true;
-                    }
+                if (prev_reads == 0) {
+                    prev_reads = rblk->num_reads;
                 }
-                else if(cstate==COH_STATE_MODIFIED) {
-                    if (prev_writes == 0) {
-                        prev_writes = cache[i].cache[idx][tag].num_writes;
-                    }
-                    if (prev_reads == 0) {
-                        prev_reads = cache[i].cache[idx][tag].num_reads;
-                    }
-                    if (prev_transfers == 0) {
-                        prev_transfers = cache[i].cache[idx][tag].num_transfers;
-                    }
-                    res=true;
+                if (prev_transfers == 0) {
+                    prev_transfers = rblk->num_transfers;
+                }
+                res=true;
+                ++rblk->num_reads;
+                if (!rblk->single_owner) {
+                    rblk->coh_state=COH_STATE_SHARED;
+                    blk.coh_state=COH_STATE_SHARED;
+                }  else {
+                    inval_block<MODE>(sim,i,idx,rblk);
+                    //stats[node_id].num_inval_msgs++;
+                    blk.coh_state=COH_STATE_EXCLUSIVE;
+                    blk.single_owner = true;
+                }
+            }
+            else if(cstate==COH_STATE_SHARED){
+                if (prev_writes == 0) {
+                    prev_writes = rblk->num_writes;
+                }
+                if (prev_reads == 0) {
+                    prev_reads = rblk->num_reads;
+                }
+                if (prev_transfers == 0) {
+                    prev_transfers = rblk->num_transfers;
+                }
+                res=true;
+                ++rblk->num_reads;
+                if (!rblk->single_owner) {
+                    rblk->coh_state=COH_STATE_SHARED;
+                    blk.coh_state=COH_STATE_SHARED;
+                } else {
+                    inval_block<MODE>(sim,i,idx,rblk);
+                    //stats[node_id].num_inval_msgs++;
+                    blk.coh_state=COH_STATE_EXCLUSIVE;
+                    blk.single_owner = true;
+                }
+            }
+            else if(cstate==COH_STATE_MODIFIED) {
+                if (prev_writes == 0) {
+                    prev_writes = rblk->num_writes;
+                }
+                if (prev_reads == 0) {
+                    prev_reads = rblk->num_reads;
+                }
+                if (prev_transfers == 0) {
+                    prev_transfers = rblk->num_transfers;
+                }
+                res=true;
+                if (!WARM) {
                     stats[i].num_wb_from_m2s++;
                     //update writeback stat for the other node
                     stats[i].num_dram_accesses++;
-                    stats[i].num_dram_writes++;
-                    ++cache[i].cache[idx][tag].num_reads;
-                    if (!cache[i].cache[idx][tag].single_owner) {
-                        cache[i].cache[idx][tag].coh_state=COH_STATE_SHARED;
-                        cache[node_id].cache[idx][tag].coh_state=COH_STATE_SHARED;
-                    } else {
-                        assert(cache[i].cache[idx][tag].single_owner);
-                        inval_block(cache,i,idx,tag);
-                        //stats[node_id].num_inval_msgs++;
-                        cache[node_id].cache[idx][tag].coh_state=COH_STATE_EXCLUSIVE;
-                        cache[node_id].cache[idx][tag].single_owner = true;
-                    }
+                    count_dram_write(sim, i);
+                }
+                ++rblk->num_reads;
+                if (!rblk->single_owner) {
+                    rblk->coh_state=COH_STATE_SHARED;
+                    blk.coh_state=COH_STATE_SHARED;
+                } else {
+                    assert(rblk->single_owner);
+                    inval_block<MODE>(sim,i,idx,rblk);
+                    //stats[node_id].num_inval_msgs++;
+                    blk.coh_state=COH_STATE_EXCLUSIVE;
+                    blk.single_owner = true;
                 }
             }
         }
-        cache[node_id].cache[idx][tag].num_writes = prev_writes + 1;
-        cache[node_id].cache[idx][tag].num_reads = prev_reads + 1;
-        if (res) cache[node_id].cache[idx][tag].num_transfers = prev_transfers + 1;
+        blk.num_writes = prev_writes + 1;
+        blk.num_reads = prev_reads + 1;
+        if (res) blk.num_transfers = prev_transfers + 1;
         //std::cout << prev_writes + 1 << "," << prev_reads + 1 << std::endl;
     }
-    if(res==true){ //found in another node
+    if(res==true && !WARM){ //found in another node
         stats[node_id].num_block_transfer++;
     }
 
     //found in other block or not, insertion would work the same
 
-    cache[node_id].set_entries[idx]++;
-    cache[node_id].lruQ[idx].push_back(tag);
-    cache[node_id].cache[idx][tag].valid = true;
-    int marked = maybe_mark_block_single_owner(cache, node_id, idx, tag, stats);
+    // Take a free way, or replace the policy's victim if the set is full
+    way = find_victim<POLICY>(&cache[node_id], idx);
+    uint64_t slot = (idx << cache[node_id].s) + way;
+    bool evicted = cache[node_id].tags[slot] != INVALID_TAG;
+    cache_entry_t victim = cache[node_id].blocks[slot];
+    if (evicted) {
+        remove_sharer<MODE>(sim, (cache[node_id].tags[slot] << cache[node_id].idx) | idx, node_id);
+        if (!WARM) {
+            stats[node_id].level[victim.block_lvl].evictions++;
+        }
+    } else {
+        cache[node_id].set_entries[idx]++;
+    }
+    dir_writeback_t back_wb[MAX_NODES];
+    uint64_t num_back_wb = 0;
+    if (MODE::coh == COH_DIRECTORY) {
+        dir_add<WARM>(sim, node_id, pfn, back_wb, &num_back_wb);
+    } else if (MODE::coh == COH_SNOOP) {
+        sharers_add(&sim->sharers, pfn, node_id);
+    }
+    cache[node_id].tags[slot] = tag;
+    cache[node_id].blocks[slot] = blk;
+    fill_way<POLICY>(&cache[node_id], idx, way, level);
+    int marked = WARM ? 0 : maybe_mark_block_single_owner<MODE>(sim, node_id, idx, tag, &cache[node_id].blocks[slot]);
     if (marked > 0) {
         stats[node_id].num_single_owner_set++;
     } else if (marked < 0) {
         stats[node_id].num_single_owner_unset++;
     }
     if (rw == WRITE) {
-        cache[node_id].cache[idx][tag].dirty = true;
+        cache[node_id].blocks[slot].dirty = true;
     }
     if (rw == READ && res==false) { // only go to dram if it wasn't in another cache
-        ++stats[node_id].num_dram_accesses;
-        ++stats[node_id].num_dram_reads;
-        if (single_owner) {
-            cache[node_id].cache[idx][tag].single_owner = true;
+        if (!WARM) {
+            ++stats[node_id].num_dram_accesses;
+            ++stats[node_id].num_dram_reads;
+        }
+        if (sim->single_owner) {
+            cache[node_id].blocks[slot].single_owner = true;
         } else {
-            cache[node_id].cache[idx][tag].single_owner = false;
+            cache[node_id].blocks[slot].single_owner = false;
         }
     }
+    if (MODE::coh == COH_DIRECTORY) {
+        dir_set_state(sim, node_id, pfn, cache[node_id].blocks[slot].coh_state);
+    }
 
-	//moved eviction handling to be done after the installation of the line.
-	// In reality, would need to evict before installing. but it breaks with the recursive thing..
-	//if (cache[node_id].set_entries[idx] == (uint64_t)(1 << cache[node_id].s)) {
-	if (cache[node_id].set_entries[idx]-1 == (uint64_t)(1 << cache[node_id].s)) {
-        // victim needed if set is full
-        uint64_t victimTag = cache[node_id].lruQ[idx].front();
-		uint64_t evicted_orig_pfn = cache[node_id].cache[idx][victimTag].orig_pfn;
-		uint64_t evicted_level = cache[node_id].cache[idx][victimTag].block_lvl;
-		bool dirty_wb = cache[node_id].cache[idx][victimTag].dirty;
-        // Remove the victim (moved eviction before handling parent update)
-        inval_block(cache, node_id, idx, victimTag);
-        if (dirty_wb) {
-            ++stats[node_id].num_dram_accesses;
-            ++stats[node_id].num_dram_writes;
-            stats[node_id].writebacks_l1++;
-            if (!eager && level != total_levels - 1) {
-                // Find parent addr
-                //uint64_t metadata_offset = orig_pfn >> ((level + 2) * BLOCKS_PER_TOC_NODE);
-                //uint64_t metadata_pfn = lv_addr_offset[level + 1] + metadata_offset;
-                //sim_access_cache(cache, node_id, metadata_pfn, rw, stats, eager, orig_pfn, level + 1);
-				
+	// The victim is replaced in place above, its writeback and parent update are handled
+	// once the new block is installed so a lazy update never sees the set over capacity.
+	if (evicted) {
+        if (victim.dirty) {
+            if (!WARM) {
+                ++stats[node_id].num_dram_accesses;
+                count_dram_write(sim, node_id);
+                stats[node_id].writebacks_l1++;
+                stats[node_id].level[victim.block_lvl].dirty_evictions++;
+            }
+            if (!MODE::eager && level != sim->tree.total_levels - 1) {
+                if (!WARM) {
+                    stats[node_id].level[victim.block_lvl].lazy_propagations++;
+                }
 				//DBG counter
 				cache[node_id].lazy_eviction_count++;
 				//std::cout<<"lazy evictions from this access: "<<cache[node_id].lazy_eviction_count<<std::endl;
-				// Find Parent ADDR using idx and victimTag
-        		sim_verify_access(cache, node_id, evicted_level + 1, evicted_orig_pfn, stats, eager, WRITE);
+				// Update the parent of the victim
+                sim->spawned.push_back({node_id, victim.block_lvl + 1, victim.orig_pfn, 0});
             }
         }
     }
+    // Blocks invalidated by a directory eviction update their parents the same way
+    for (uint64_t i = 0; i < num_back_wb && !MODE::eager; i++) {
+        if (!WARM) {
+            stats[back_wb[i].node_id].level[back_wb[i].block_lvl].lazy_propagations++;
+        }
+        sim->spawned.push_back({back_wb[i].node_id, back_wb[i].block_lvl + 1, back_wb[i].orig_pfn, 0});
+    }
 
     return res;
 }
 
-static int64_t sim_verify_access(cache_t *cache, uint64_t node_id, uint32_t level, uint64_t pfn, sim_stats_t *stats, bool eager,
-                                 bool rw) {
-    if (level == total_levels - 1) {
-    #ifdef DEBUG
-        std::cout << "VERIFY: Received hit at root" << std::endl;
-    #endif
-        return level;
+/**
+ * @brief One cache access of a tree walk, timed when the timing model is on
+ *
+ * @param critical Part of the verification, otherwise a lazy propagation
+ */
+template <typename POLICY, bool WARM, typename MODE>
+static inline bool walk_access(sim_t *sim, uint64_t node_id, uint64_t pfn, bool rw, uint64_t orig_pfn,
+                               uint32_t level, bool critical) {
+    if (WARM || sim->timing == NULL) {
+        return sim_access_cache<POLICY, WARM, MODE>(sim, node_id, pfn, rw, orig_pfn, level);
     }
-    pfn = pfn % (MAX_MEM_SIZE / (1ULL << CPU_CACHE_BLOCK_SIZE));
-    uint64_t metadata_offset = pfn >> ((level + 1) * BLOCKS_PER_TOC_NODE);
-    uint64_t metadata_pfn = lv_addr_offset[level] + metadata_offset;
-#ifdef DEBUG
-    std::cout << "VERIFY: Generated address " << std::hex << metadata_pfn << " for level " << std::dec << level
-              << ", pfn " << std::hex << pfn << std::endl;
-#endif
-    bool hit = sim_access_cache(cache, node_id, metadata_pfn, rw, stats, eager, pfn, level);
-    //if (rw == WRITE || !hit) {
-    if (((rw == WRITE) && eager ) || !hit) { // no need to go to root if lazy update?
-    #ifdef DEBUG
-        std::cout << "VERIFY: Received miss at level " << level << std::endl;
-    #endif
-        return sim_verify_access(cache, node_id, level + 1, pfn, stats, eager, rw);
+    timing_snapshot(sim, node_id, &sim->timing->before);
+    bool hit = sim_access_cache<POLICY, WARM, MODE>(sim, node_id, pfn, rw, orig_pfn, level);
+    timing_cache_access(sim->timing, sim, node_id, critical);
+    return hit;
+}
+
+// A walk goes on to the parent after a miss, and after a hit when an eager write updates every level
+static inline bool walk_continues(bool rw, bool eager, bool hit) {
+    return (rw == WRITE && eager) || !hit;
+}
+
+/**
+ * @brief Queue the lazy propagations caused by the last cache access on top of the work list
+ *
+ * They are pushed in reverse so they are processed in the order they were caused, each one to the
+ * root before the next, as the recursive walk did.
+ *
+ * @param depth Cascade depth of the walk whose access caused them
+ * @param access_node Node whose access started the cascade
+ */
+template <bool WARM>
+static inline void walk_push_spawned(sim_t *sim, uint64_t depth, uint64_t access_node) {
+    if (sim->spawned.empty()) {
+        return;
     }
-#ifdef DEBUG
-    std::cout << "VERIFY: Received hit at level " << level << std::endl;
-#endif
-    return level;
+    for (size_t i = sim->spawned.size(); i-- > 0;) {
+        tree_walk_t walk = sim->spawned[i];
+        walk.depth = depth + 1;
+        sim->walks.push_back(walk);
+    }
+    sim->spawned.clear();
+    if (WARM) {
+        return;
+    }
+    uint64_t *max_depth = &sim->stats[access_node].max_cascade_depth;
+    *max_depth = std::max(*max_depth, depth + 1);
 }
 
-static void sim_write_access(cache_t *cache, uint64_t node_id, uint32_t level, uint64_t pfn, sim_stats_t *stats, bool eager) {
-    // TODO: Lazy update
+/**
+ * @brief Process the work list until it is empty. Lazy propagations are dirty writes stopping at the
+ * first level that hits, a level they miss in can evict further dirty blocks which are pushed on top.
+ */
+template <unsigned ARITY, typename POLICY, bool WARM, typename MODE>
+static void walk_drain(sim_t *sim, uint64_t access_node) {
+    const tree_geometry_t *tree = &sim->tree;
+    while (!sim->walks.empty()) {
+        tree_walk_t walk = sim->walks.back();
+        sim->walks.pop_back();
+        if (walk.level >= tree->pin_level) {
+            // The root and the pinned levels are on chip
+            if (!WARM && walk.level < tree->total_levels - 1) {
+                sim->stats[walk.node_id].num_pinned_accesses++;
+            }
+            continue;
+        }
+        uint64_t metadata_pfn = tree_metadata_pfn<ARITY>(tree, walk.level, walk.pfn);
+        bool hit = walk_access<POLICY, WARM, MODE>(sim, walk.node_id, metadata_pfn, WRITE, walk.pfn, walk.level,
+                                                   false);
+        if (walk_continues(WRITE, MODE::eager, hit)) {
+            sim->walks.push_back({walk.node_id, walk.level + 1, walk.pfn, walk.depth});
+        }
+        walk_push_spawned<WARM>(sim, walk.depth, access_node);
+    }
+}
 
-    if (level == total_levels - 1) {
-        return;     // Stop recursion at root
+/**
+ * @brief Walk the integrity tree from the leaf towards the root for one access
+ *
+ * The metadata pfns of every level are computed in one pass, then levels are accessed until the walk
+ * stops. It always stops at the pinned buffer, which holds every block of its levels. Lazy propagations
+ * caused by an access are processed from the work list before the walk moves on, so cache state evolves
+ * exactly as with a depth-first recursive walk.
+ *
+ * @return Level the verification stopped at, tree->pin_level if it reached the pinned buffer or the root
+ */
+template <unsigned ARITY, typename POLICY, bool WARM, typename MODE>
+static int64_t sim_verify_access(sim_t *sim, uint64_t node_id, uint64_t pfn, bool rw) {
+    const tree_geometry_t *tree = &sim->tree;
+    uint32_t root = tree->total_levels - 1;
+    uint32_t pinned = tree->pin_level;
+    uint64_t path[MAX_TREE_LEVELS];
+    pfn &= tree->pfn_mask;
+    for (uint32_t level = 0; level < pinned; level++) {
+        path[level] = tree_metadata_pfn<ARITY>(tree, level, pfn);
     }
-    // Somehow force to <16GB??
-    pfn = pfn % (MAX_MEM_SIZE / (1ULL << CPU_CACHE_BLOCK_SIZE));
-    uint64_t metadata_offset = pfn >> ((level + 1) * BLOCKS_PER_TOC_NODE);
-    uint64_t metadata_pfn = lv_addr_offset[level] + metadata_offset;
+    for (uint32_t level = 0; level < pinned; level++) {
 #ifdef DEBUG
-    std::cout << "WRITE: Writing to address " << std::hex << metadata_pfn << " for level " << std::dec << level
-              << ", pfn " << std::hex << pfn << std::endl;
+        std::cout << "VERIFY: Generated address " << std::hex << path[level] << " for level " << std::dec << level
+                  << ", pfn " << std::hex << pfn << std::endl;
 #endif
-    bool hit = sim_access_cache(cache, node_id, metadata_pfn, WRITE, stats, eager, pfn, level);   // Need to stop somewhere for lazy
-    ++stats[node_id].num_dram_accesses;
-    ++stats[node_id].num_dram_writes;
-    if (!eager && hit) {
-        return;
+        bool hit = walk_access<POLICY, WARM, MODE>(sim, node_id, path[level], rw, pfn, level, true);
+        if (!sim->spawned.empty()) {
+            walk_push_spawned<WARM>(sim, 0, node_id);
+            walk_drain<ARITY, POLICY, WARM, MODE>(sim, node_id);
+        }
+        if (!walk_continues(rw, MODE::eager, hit)) {
+#ifdef DEBUG
+            std::cout << "VERIFY: Received hit at level " << level << std::endl;
+#endif
+            return level;
+        }
+    }
+    if (!WARM && pinned < root) {
+        sim->stats[node_id].num_pinned_accesses++;
     }
-    sim_write_access(cache, node_id, level + 1, pfn, stats, eager);
+#ifdef DEBUG
+    std::cout << "VERIFY: Received hit at level " << pinned << " (on chip)" << std::endl;
+#endif
+    return pinned;
 }
 
 /**
  * @brief Subroutine that simulates the cache one trace event at a time.
  * 
+ *  @param node_id Node issuing the access
  *  @param rw 0 for Read or 1 for Write
  *  @param addr Address being accessed
- *  @param stats Simulation stats
  */
-void sim_access(cache_t *cache, uint64_t node_id, bool rw, uint64_t addr, sim_stats_t* stats) {
+void sim_access(sim_t *sim, uint64_t node_id, bool rw, uint64_t addr) {
+    cache_t *cache = sim->cache.data();
+    sim_stats_t *stats = sim->stats.data();
     // 64 bytes --> 1 CPU block
     // 8 blocks --> 1 entry
 	
 	cache[node_id].lazy_eviction_count=0;
 
-    uint64_t addr_pfn = addr >> CPU_CACHE_BLOCK_SIZE;
+    uint64_t addr_pfn = addr >> sim->tree.block_size;
     int lv_hit = 0;
+    uint64_t cache_accesses = stats[node_id].accesses_l1;
+    uint64_t dram_accesses = stats[node_id].num_dram_accesses;
+    if (sim->timing) {
+        timing_begin(sim->timing, node_id);
+    }
     if (rw == READ) {
     #ifdef DEBUG
         std::cout << "ACCESS: Sending pfn " << std::hex << addr_pfn << " for addr " << addr << " to verify\n";
     #endif
         stats[node_id].reads++;
-        lv_hit = sim_verify_access(cache, node_id, 0, addr_pfn, stats, cache[node_id].eager,  READ);
+        lv_hit = sim->verify(sim, node_id, addr_pfn, READ);
         stats[node_id].total_levels += lv_hit;
+        stats[node_id].verify_depth[lv_hit]++;
     #ifdef DEBUG
         std::cout << "ACCESS: Verified pfn " << std::hex << addr_pfn << std::dec << " at level " << lv_hit << std::endl;
     #endif
@@ -484,13 +1089,19 @@ void sim_access(cache_t *cache, uint64_t node_id, bool rw, uint64_t addr, sim_st
 #endif
         stats[node_id].writes++;
         // Go till root
-        lv_hit = sim_verify_access(cache, node_id, 0, addr_pfn, stats, cache[node_id].eager, WRITE);
+        lv_hit = sim->verify(sim, node_id, addr_pfn, WRITE);
         stats[node_id].total_levels += lv_hit;
+        stats[node_id].verify_depth[lv_hit]++;
     #ifdef DEBUG
         std::cout << "Verified pfn " << std::hex << addr_pfn << std::dec << " at level " << lv_hit << std::endl;
     #endif
-        // Set dirty bits
-        //sim_write_access(cache, node_id, 0, addr_pfn, stats, cache[node_id].eager);
+    }
+    sim_hist_t *hist = &sim->hist[node_id];
+    hist_record(&hist->levels, lv_hit + 1);
+    hist_record(&hist->cache_accesses, stats[node_id].accesses_l1 - cache_accesses);
+    hist_record(&hist->dram_accesses, stats[node_id].num_dram_accesses - dram_accesses);
+    if (sim->timing) {
+        hist_record(&hist->cycles, timing_end(sim->timing, node_id));
     }
     // Generate eq metadata cache address
     // Issue a cache access and see if hit
@@ -498,6 +1109,120 @@ void sim_access(cache_t *cache, uint64_t node_id, bool rw, uint64_t addr, sim_st
     // Keep going till hit
 }
 
+/**
+ * @brief One level of the tree walk of an access, for engines that schedule the levels themselves. Only
+ * eager updates can be run this way, they never cause lazy propagations.
+ *
+ * @param metadata_pfn Block of the level, from tree_metadata_pfn
+ * @param pfn Data pfn of the access, masked with tree.pfn_mask
+ * @return true on a hit
+ */
+template <typename POLICY, typename MODE>
+static bool sim_walk_level(sim_t *sim, uint64_t node_id, uint64_t metadata_pfn, uint64_t pfn, uint64_t level, bool rw) {
+    bool hit = walk_access<POLICY, false, MODE>(sim, node_id, metadata_pfn, rw, pfn, level, true);
+    assert(sim->spawned.empty());
+    return hit;
+}
+
+/**
+ * @brief Functional warming: the access leaves the caches, replacement and coherence state as sim_access
+ * would, without counting statistics, timing it or promoting blocks to single owner
+ */
+void sim_warm(sim_t *sim, uint64_t node_id, bool rw, uint64_t addr) {
+    sim->warm(sim, node_id, addr >> sim->tree.block_size, rw);
+}
+
+/**
+ * @brief Add the counters of src to dst. Ratios computed by compute_stats are left out.
+ */
+void sim_stats_add(sim_stats_t *dst, const sim_stats_t *src) {
+    dst->reads += src->reads;
+    dst->writes += src->writes;
+    dst->accesses_l1 += src->accesses_l1;
+    dst->array_lookups_l1 += src->array_lookups_l1;
+    dst->tag_compares_l1 += src->tag_compares_l1;
+    dst->hits_l1 += src->hits_l1;
+    dst->misses_l1 += src->misses_l1;
+    dst->writebacks_l1 += src->writebacks_l1;
+    dst->cache_flush_writebacks += src->cache_flush_writebacks;
+    dst->total_levels += src->total_levels;
+    dst->eff_reads += src->eff_reads;
+    dst->eff_writes += src->eff_writes;
+    dst->num_dram_writes += src->num_dram_writes;
+    dst->num_dram_reads += src->num_dram_reads;
+    dst->num_dram_accesses += src->num_dram_accesses;
+    dst->num_pinned_accesses += src->num_pinned_accesses;
+    dst->num_single_owner_set += src->num_single_owner_set;
+    dst->num_single_owner_unset += src->num_single_owner_unset;
+    dst->num_inval_msgs += src->num_inval_msgs;
+    dst->num_wb_from_m2s += src->num_wb_from_m2s;
+    dst->num_block_transfer += src->num_block_transfer;
+    dst->num_dir_lookups += src->num_dir_lookups;
+    dst->num_dir_evictions += src->num_dir_evictions;
+    dst->num_dir_msgs += src->num_dir_msgs;
+    for (uint64_t l = 0; l < MAX_TREE_LEVELS; l++) {
+        dst->level[l].accesses += src->level[l].accesses;
+        dst->level[l].hits += src->level[l].hits;
+        dst->level[l].misses += src->level[l].misses;
+        dst->level[l].evictions += src->level[l].evictions;
+        dst->level[l].dirty_evictions += src->level[l].dirty_evictions;
+        dst->level[l].lazy_propagations += src->level[l].lazy_propagations;
+        dst->verify_depth[l] += src->verify_depth[l];
+    }
+    dst->cycles += src->cycles;
+    dst->dram_transfers += src->dram_transfers;
+    dst->max_cascade_depth = std::max(dst->max_cascade_depth, src->max_cascade_depth);
+}
+
+/**
+ * @brief Make shard a view of sim for a thread that only accesses its own subset of the cache sets
+ *
+ * The shard shares the cache arrays and directory of sim but counts into its own statistics, histograms and
+ * replacement clocks, and tracks the sharers of its blocks in its own table. sim must not be accessed
+ * until sim_shard_merge.
+ *
+ * @param num_sets Sets of each cache the shard owns
+ */
+void sim_shard_setup(const sim_t *sim, sim_t *shard, uint64_t num_sets) {
+    *shard = *sim;
+    shard->stats.assign(sim->num_nodes, sim_stats_t());
+    shard->hist.assign(sim->num_nodes, sim_hist_t());
+    for (auto &cache : shard->cache) {
+        cache.repl_clock = 0;
+    }
+    // Directory sets are owned with the cache sets they hold, LRU order is only compared within a set
+    shard->dir.lru_clock = 0;
+    if (!sim->directory) {
+        sharers_setup(&shard->sharers, 2 * sim->num_nodes * (num_sets << sim->cache[0].s));
+    }
+}
+
+/**
+ * @brief Fold the statistics, replacement clocks and sharers of a shard back into sim and free the shard
+ */
+void sim_shard_merge(sim_t *sim, sim_t *shard) {
+    for (uint64_t i = 0; i < sim->num_nodes; i++) {
+        sim_stats_add(&sim->stats[i], &shard->stats[i]);
+        hist_merge(&sim->hist[i].levels, &shard->hist[i].levels);
+        hist_merge(&sim->hist[i].cache_accesses, &shard->hist[i].cache_accesses);
+        hist_merge(&sim->hist[i].dram_accesses, &shard->hist[i].dram_accesses);
+        hist_merge(&sim->hist[i].cycles, &shard->hist[i].cycles);
+        sim->cache[i].repl_clock += shard->cache[i].repl_clock;
+    }
+    sim->dir.lru_clock += shard->dir.lru_clock;
+    if (sim->directory) {
+        return;
+    }
+    for (uint64_t j = 0; j <= shard->sharers.mask; j++) {
+        const sharer_entry_t *entry = &shard->sharers.entries[j];
+        for (uint64_t nodes = entry->nodes; nodes; nodes &= nodes - 1) {
+            sharers_add(&sim->sharers, entry->pfn, __builtin_ctzll(nodes));
+        }
+    }
+    delete[] shard->sharers.entries;
+    shard->sharers.entries = NULL;
+}
+
 void compute_stats(cache_t *cache, sim_stats_t *stats) {
     //double tag_compare_time = L1_TAG_COMPARE_TIME_CONST + L1_TAG_COMPARE_TIME_PER_S * (cache->s);
     double tag_compare_time = cache->tag_compare_time;
@@ -507,6 +1232,13 @@ void compute_stats(cache_t *cache, sim_stats_t *stats) {
                                 stats->accesses_l1 + DRAM_ACCESS_PENALTY * stats->misses_l1 * 1.0)/
                                 stats->accesses_l1;
     stats->avg_level = stats->total_levels * 1.0/(stats->reads + stats->writes);
+    uint64_t num_blocks = (1ULL << cache->idx) << cache->s;
+    stats->resident_entries = 0;
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        if (cache->tags[i] != INVALID_TAG) {
+            stats->resident_entries++;
+        }
+    }
     /*for (unsigned j = 0; j < cache->idx; ++j) {
         if (cache->cache[j].size() == 0)
             continue;
@@ -518,15 +1250,46 @@ void compute_stats(cache_t *cache, sim_stats_t *stats) {
 
 /**
  * @brief Subroutine for cleaning up any outstanding memory operations and calculating overall statistics
- * such as miss rate or average access time.
- * 
- * @param stats Simulation stats
+ * such as miss rate or average access time. The final statistics stay in sim->stats.
  */
-void sim_finish(cache_t *cache, sim_stats_t *stats) {
-    for(int i=0;i<NUM_NODES;i++){
-    compute_stats(&(cache[i]), &(stats[i]));
-    delete[] cache[i].cache;
-    delete[] cache[i].lruQ;
+void sim_finish(sim_t *sim) {
+    cache_t *cache = sim->cache.data();
+    // A block the coherence tables still list for a node that dropped it shows up as more entries than ways
+    for (uint64_t i = 0; i < sim->num_nodes; i++) {
+        sim->stats[i].coherence_entries = 0;
+    }
+    if (sim->directory) {
+        for (uint64_t e = 0; e < (sim->dir.set_mask + 1) * DIR_WAYS; e++) {
+            for (uint64_t nodes = sim->dir.entries[e].sharers; nodes; nodes &= nodes - 1) {
+                sim->stats[__builtin_ctzll(nodes)].coherence_entries++;
+            }
+        }
+    } else if (sim->sharers.entries) {
+        for (uint64_t j = 0; j <= sim->sharers.mask; j++) {
+            for (uint64_t nodes = sim->sharers.entries[j].nodes; nodes; nodes &= nodes - 1) {
+                sim->stats[__builtin_ctzll(nodes)].coherence_entries++;
+            }
+        }
+    }
+    for(uint64_t i=0;i<sim->num_nodes;i++){
+    compute_stats(&(cache[i]), &(sim->stats[i]));
+    delete[] cache[i].tags;
+    delete[] cache[i].blocks;
+    delete[] cache[i].repl;
     delete[] cache[i].set_entries;
     }
+    tree_free(&sim->tree);
+    delete[] sim->sharers.entries;
+    delete[] sim->dir.entries;
+    if (sim->timing) {
+        for (uint64_t i = 0; i < sim->num_nodes; i++) {
+            const timing_node_t *node = &sim->timing->node[i];
+            sim_stats_t *stats = &sim->stats[i];
+            stats->cycles = node->now;
+            stats->dram_transfers = node->dram_transfers;
+            stats->avg_dram_queue_delay = node->dram_transfers ? node->dram_queue_cycles * 1.0 / node->dram_transfers : 0;
+        }
+        timing_free(sim->timing);
+        sim->timing = NULL;
+    }
 }
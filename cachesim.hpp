@@ -1,17 +1,33 @@
 #ifndef CACHESIM_HPP
 #define CACHESIM_HPP
 
-#include <map>
-#include <list>
 #include <algorithm>
+#include <vector>
 #include <stdint.h>
 #include <stdbool.h>
+#include "tagmatch.hpp"
+#include "replace.hpp"
+#include "timing.hpp"
+#include "hist.hpp"
 
-#define CPU_CACHE_BLOCK_SIZE 6
-#define BLOCKS_PER_TOC_NODE 3
+// Default tree geometry, all log2
+#define CPU_CACHE_BLOCK_SIZE 6          // Data bytes covered by one leaf counter
+#define BLOCKS_PER_TOC_NODE 3           // Children per tree node
+#define MAX_MEM_SIZE 33                 // Protected memory bytes
+#define MAX_TREE_ARITY 16               // Children per tree node at most
+
+#define TREE_BASE_PFN 0xfffffff000000000ULL  // Metadata pfn of the first leaf counter block
+#define TREE_PFN_SPACE 36                    // Metadata pfns of all levels fit in 2^36 from TREE_BASE_PFN
+#define METADATA_BLOCK_SIZE 6           // Metadata cache block bytes (log), fixed whatever the tree geometry
 #define ULL unsigned long long
 
-#define NUM_NODES 4
+#define MAX_NODES 64                     // Sharers are tracked in a 64-bit mask
+
+#define INVALID_TAG (~0ULL)             // Tag value marking a free way
+#define MAX_TREE_LEVELS 64              // Integrity tree levels with per-level statistics
+
+#define DIR_WAYS 16                     // Associativity of the coherence directory
+#define DIR_NO_OWNER (~0ULL)            // Directory owner of a block no node holds in M or E
 
 typedef enum {
     READ,
@@ -26,7 +42,6 @@ typedef enum {
 } coh_state_t;
 
 typedef struct cache_entry {
-    bool valid;                 // valid bit
     bool dirty;                 // dirty bit
 	uint64_t orig_pfn;			// used for eviction in lazy update
 	uint64_t block_lvl;			// used for eviction in lazy update
@@ -38,8 +53,11 @@ typedef struct cache_entry {
 } cache_entry_t;
 
 typedef struct cache {
-    std::map<uint64_t, cache_entry_t> *cache;   // Cache is implemented as an array of hash tables (one per set)
-    std::list<uint64_t> *lruQ;                  // Doubly linked list for LRU status (one per set)
+    uint64_t *tags;                             // Packed tag array, 2^idx sets x 2^s ways, INVALID_TAG if free
+    tag_match_fn match;                         // Compares a tag against every way of a set
+    cache_entry_t *blocks;                      // Per-way block state, same layout as tags
+    uint64_t *repl;                             // Per-way replacement policy state, same layout as tags
+    uint64_t repl_clock;                        // Replacement policy state shared by all sets
     uint64_t *set_entries;                      // Utility array to check if a set is full
     uint64_t c;                                 // Size of cache
     uint64_t b;                                 // Block size of cache
@@ -54,13 +72,37 @@ typedef struct sim_config {
     uint64_t c;                     // Metadata cache size (log)
     uint64_t s;                     // Set associativity
     bool f;                         // R/W addr reversed or not
-    bool v;                         // Stats every million instructions or not
+    bool v;                         // Log statistics for every interval of accesses
     bool eager;                     // Whether to do eager or lazy updates
     bool single_owner;              // Single ownership for multinode case
     bool hybrid_coh;
     uint64_t write_thresh;
+    uint64_t num_nodes;             // Number of nodes, one trace each
+    bool directory;                 // Directory coherence instead of snooping
+    uint64_t dir_size;              // Directory entries (log), 0 for twice the blocks of all caches
+    uint64_t arity;                 // Children per tree node (log)
+    uint64_t block_size;            // Data bytes covered by one leaf counter (log)
+    uint64_t mem_size;              // Protected memory bytes (log)
+    tag_match_kind_t tag_match;     // Tag compare kernel
+    repl_policy_t repl;             // Replacement policy of the metadata caches
+    uint64_t pin_levels;            // Tree levels below the root held in the pinned buffer
+    bool timing;                    // Run the timing model on top of the functional one
+    uint64_t mshrs;                 // Timing: outstanding fetches per node
+    uint64_t dram_latency;          // Timing: cycles from the start of a DRAM transfer to its data
+    uint64_t dram_bw;               // Timing: bytes the shared DRAM channel moves per cycle
+    uint64_t coh_latency;           // Timing: cycles of one coherence message
 } sim_config_t;
 
+// Counters of one tree level, kept together as they are updated together
+typedef struct sim_level_stats {
+    uint64_t accesses;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;             // blocks of this level replaced
+    uint64_t dirty_evictions;       // dirty blocks of this level evicted
+    uint64_t lazy_propagations;     // dirty evictions of this level written into their parent (lazy update)
+} sim_level_stats_t;
+
 typedef struct sim_stats {
     uint64_t reads;                 // read requests
     uint64_t writes;                // write requests
@@ -81,22 +123,143 @@ typedef struct sim_stats {
     uint64_t num_dram_writes;
     uint64_t num_dram_reads;
     uint64_t num_dram_accesses;
+    uint64_t num_pinned_accesses;   // verifications and lazy updates that stopped in the pinned buffer
     uint64_t num_single_owner_set;
     uint64_t num_single_owner_unset;
+    uint64_t resident_entries;      // ways holding a block at the end of the run
+    uint64_t coherence_entries;     // blocks the sharer table or directory lists for the node, resident_entries unless they leak
 
     //coherence stats
     uint64_t num_inval_msgs;
     uint64_t num_wb_from_m2s; //writeback triggered by read request to a modified block
     uint64_t num_block_transfer;
+
+    //directory stats, charged to the requesting node
+    uint64_t num_dir_lookups;       // requests that reached the directory
+    uint64_t num_dir_evictions;     // directory entries replaced, invalidating their sharers
+    uint64_t num_dir_msgs;          // requests, replies, forwards, invalidations and acks
+
+    //per tree level stats
+    sim_level_stats_t level[MAX_TREE_LEVELS];
+    uint64_t verify_depth[MAX_TREE_LEVELS]; // accesses whose verification stopped at each level
+
+    //timing model stats, in cycles
+    uint64_t cycles;                // completion of the node's last verification
+    uint64_t dram_transfers;        // reads and writebacks of the node on the DRAM channel
+    double avg_dram_queue_delay;    // cycles they waited for the channel
+    uint64_t max_cascade_depth;     // longest chain of lazy propagations triggered by one access
 } sim_stats_t;
 
-extern void sim_setup(cache_t *cache_core0, sim_config_t *config);
-extern void sim_access(cache_t *cache, uint64_t node_id, bool rw, uint64_t addr, sim_stats_t* p_stats);
-extern void sim_finish(cache_t *cache, sim_stats_t *p_stats);
+// Distributions of the cost of each access of one node
+typedef struct sim_hist {
+    hist_t levels;                  // tree levels walked, the level the verification stopped at included
+    hist_t cache_accesses;          // metadata cache accesses, lazy propagations included
+    hist_t dram_accesses;
+    hist_t cycles;                  // verification latency, with the timing model only
+} sim_hist_t;
+
+typedef struct sharer_entry {
+    uint64_t pfn;                   // Metadata block, INVALID_TAG if the slot is free
+    uint64_t nodes;                 // Bit i set if node i holds the block
+} sharer_entry_t;
+
+// Nodes holding each resident metadata block, so coherence actions only visit actual sharers.
+// Open addressing with linear probing, sized for every node's cache full of distinct blocks.
+typedef struct sharer_table {
+    sharer_entry_t *entries;
+    uint64_t mask;                  // Number of slots - 1
+} sharer_table_t;
+
+typedef struct dir_entry {
+    uint64_t pfn;                   // Metadata block, INVALID_TAG if the entry is free
+    uint64_t sharers;               // Bit i set if node i holds the block
+    uint64_t owner;                 // Node holding the block in M or E, DIR_NO_OWNER otherwise
+    coh_state_t state;              // MESI state of the block as seen by the directory
+    uint64_t lru;                   // Last lookup stamp for replacement
+} dir_entry_t;
+
+// Sparse directory with DIR_WAYS entries per set. It is inclusive: replacing an entry invalidates
+// the block in every node sharing it.
+typedef struct directory {
+    dir_entry_t *entries;           // Sets x DIR_WAYS
+    uint64_t set_mask;              // Number of sets - 1
+    uint64_t idx_bits;              // Set index bits of the caches, the low bits of a directory set
+    uint64_t lru_clock;
+} directory_t;
+
+typedef struct tree_geometry {
+    uint64_t arity;                 // Children per tree node (log)
+    uint64_t block_size;            // Data bytes covered by one leaf counter (log)
+    uint64_t total_levels;          // Levels of the integrity tree, the root included
+    uint64_t pin_level;             // Lowest level of the pinned buffer, total_levels - 1 (the root) if none
+    uint64_t pfn_mask;              // Data pfns wrap around the protected memory
+    uint64_t *lv_addr_offset;       // Metadata pfn of the first block of each level
+} tree_geometry_t;
+
+// Update of the path from one tree level up to the root, pending on the work list of the tree walk
+typedef struct tree_walk {
+    uint64_t node_id;
+    uint64_t level;                 // Next level to access
+    uint64_t pfn;                   // Data pfn whose path is walked
+    uint64_t depth;                 // Lazy propagations between the access and this walk
+} tree_walk_t;
+
+// One simulation: the metadata caches and statistics of every node plus the tree geometry and
+// coherence policy they share. Simulators hold no global state and can run concurrently.
+typedef struct sim {
+    sim_config_t config;
+    uint64_t num_nodes;
+    std::vector<cache_t> cache;                 // Metadata cache of each node
+    std::vector<sim_stats_t> stats;             // Statistics of each node, kept after sim_finish
+    std::vector<sim_hist_t> hist;               // Cost distributions of each node, kept after sim_finish
+    sharer_table_t sharers;                     // Snooping: nodes holding each block
+    bool directory;                             // Directory coherence instead of snooping
+    directory_t dir;
+    tree_geometry_t tree;
+    // Tree walks specialized for the arity of the tree and the update and coherence policies, full and functional warming
+    int64_t (*verify)(struct sim *sim, uint64_t node_id, uint64_t pfn, bool rw);
+    int64_t (*warm)(struct sim *sim, uint64_t node_id, uint64_t pfn, bool rw);
+    bool (*walk_level)(struct sim *sim, uint64_t node_id, uint64_t metadata_pfn, uint64_t pfn, uint64_t level,
+                       bool rw);
+    std::vector<tree_walk_t> walks;             // Lazy propagations not processed yet, next one last, unbounded
+    std::vector<tree_walk_t> spawned;           // Lazy propagations caused by the current cache access
+    timing_t *timing;                           // Timing model, NULL for functional runs
+    bool single_owner;                          // Blocks filled from DRAM start out single owner
+    bool hybrid_coh;                            // Switch write heavy blocks to single owner
+    uint64_t write_thresh;                      // Writes before a block switches to single owner
+} sim_t;
+
+extern void sim_setup(sim_t *sim, sim_config_t *config);
+extern void sim_access(sim_t *sim, uint64_t node_id, bool rw, uint64_t addr);
+extern void sim_warm(sim_t *sim, uint64_t node_id, bool rw, uint64_t addr);
+extern void sim_finish(sim_t *sim);
 extern void compute_stats(cache_t *cache, sim_stats_t *stats);
+extern void sim_stats_add(sim_stats_t *dst, const sim_stats_t *src);
+extern void sim_shard_setup(const sim_t *sim, sim_t *shard, uint64_t num_sets);
+extern void sim_shard_merge(sim_t *sim, sim_t *shard);
+extern cache_entry_t *cache_probe(cache_t *cache, uint64_t idx, uint64_t tag);
+extern uint64_t dir_set_index(const directory_t *dir, uint64_t pfn);
+extern uint64_t tree_levels(const sim_config_t *config);
+extern const char *tree_check(const sim_config_t *config);
+extern void tree_setup(tree_geometry_t *tree, const sim_config_t *config);
+extern void tree_free(tree_geometry_t *tree);
+extern uint64_t tree_pinned_blocks(const tree_geometry_t *tree);
+
+/**
+ * @brief Metadata block covering pfn at a level of the integrity tree
+ *
+ * @tparam ARITY Children per tree node (log) known at compile time, 0 to use tree->arity
+ * @param pfn Data pfn, already masked with tree->pfn_mask
+ */
+template <unsigned ARITY>
+static inline uint64_t tree_metadata_pfn(const tree_geometry_t *tree, uint32_t level, uint64_t pfn) {
+    uint64_t arity = ARITY ? ARITY : tree->arity;
+    return tree->lv_addr_offset[level] + (pfn >> ((level + 1) * arity));
+}
 
 static const double DRAM_ACCESS_PENALTY = 100;
-static const unsigned long long MAX_MEM_SIZE = 8ULL * 1024 * 1024 * 1024;
+// The pinned buffer is read like the data array of the metadata cache, without tag compares
+static const double PINNED_ACCESS_TIME = 1;
 // Hit time (HT) for an L1 Cache:
 // is HIT_TIME_CONST + (HIT_TIME_PER_S * S)
 static const double L1_ARRAY_LOOKUP_TIME_CONST = 1;
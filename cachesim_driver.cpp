@@ -1,61 +1,233 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <iostream>
 #include <cassert>
+#include <cmath>
+#include <vector>
+#include <thread>
 #include "cachesim.hpp"
+#include "trace.hpp"
+#include "sweep.hpp"
+#include "mrc.hpp"
+#include "interval.hpp"
+#include "checkpoint.hpp"
+#include "sample.hpp"
+#include "shard.hpp"
+#include "workload.hpp"
 
 static void print_help(void);
 static void print_sim_config(sim_config_t *sim_config);
-static void print_statistics(sim_stats_t* stats, sim_config_t *sim_config);
-static void print_statistics_all_nodes(sim_stats_t* stats, sim_config_t *config);
+static void print_statistics(sim_stats_t* stats, sim_hist_t *hist, sim_config_t *sim_config);
+static void print_statistics_all_nodes(sim_stats_t* stats, sim_hist_t *hist, sim_config_t *config);
+static void close_traces(std::vector<trace_t *> &trace);
+static bool parse_log2(const char *arg, uint64_t *value);
 
 int main(int argc, char **argv) {
     sim_config_t config = {18, 2, 0, 0, 1, 0, 0, 0};
-    FILE *trace[NUM_NODES] = {NULL};
+    config.arity = BLOCKS_PER_TOC_NODE;
+    config.block_size = CPU_CACHE_BLOCK_SIZE;
+    config.mem_size = MAX_MEM_SIZE;
+    config.mshrs = TIMING_MSHRS;
+    config.dram_latency = TIMING_DRAM_LATENCY;
+    config.dram_bw = TIMING_DRAM_BW;
+    config.coh_latency = TIMING_COH_LATENCY;
+    std::vector<const char *> trace_path;
+    std::vector<trace_t *> trace;
+    const char *convert_path = NULL;
+    const char *sweep_path = NULL;
+    bool mrc = false;
+    uint64_t interval = 1000000;
+    bool interval_json = false;
+    const char *interval_path = NULL;
+    unsigned num_threads = 0;
+    bool pin_report = false;
+    const char *checkpoint_path = NULL;
+    uint64_t checkpoint_at = UINT64_MAX;
+    const char *restore_path = NULL;
+    sample_plan_t sample_plan = {0, SAMPLE_LENGTH, 0, {}};
+    const char *sample_warm = NULL;
+    unsigned num_shards = 0;
+    bool shard_check = false;
+    workload_config_t workload;
+    bool synthetic = false;
     int opt;
-    //cache_t cache_core0;
-    cache_t cache_core[NUM_NODES];
+    sim_t sim;
+
+    static const struct option long_opts[] = {
+        {"convert", required_argument, NULL, 'B'},
+        {"sweep", required_argument, NULL, 'W'},
+        {"threads", required_argument, NULL, 'P'},
+        {"dir-size", required_argument, NULL, 'E'},
+        {"mrc", no_argument, NULL, 'M'},
+        {"interval", required_argument, NULL, 'N'},
+        {"interval-format", required_argument, NULL, 'J'},
+        {"interval-out", required_argument, NULL, 'Q'},
+        {"arity", required_argument, NULL, 'A'},
+        {"block-size", required_argument, NULL, 'K'},
+        {"mem-size", required_argument, NULL, 'G'},
+        {"tag-match", required_argument, NULL, 'X'},
+        {"tag-bench", no_argument, NULL, 'Y'},
+        {"repl", required_argument, NULL, 'R'},
+        {"pin", required_argument, NULL, 'U'},
+        {"pin-report", required_argument, NULL, 'Z'},
+        {"timing", no_argument, NULL, 'g'},
+        {"mshrs", required_argument, NULL, 'm'},
+        {"dram-latency", required_argument, NULL, 'e'},
+        {"dram-bw", required_argument, NULL, 'w'},
+        {"coh-latency", required_argument, NULL, 'n'},
+        {"checkpoint", required_argument, NULL, 'b'},
+        {"checkpoint-at", required_argument, NULL, 'x'},
+        {"restore", required_argument, NULL, 'r'},
+        {"sample", required_argument, NULL, 'a'},
+        {"sample-len", required_argument, NULL, 'j'},
+        {"sample-warm", required_argument, NULL, 'k'},
+        {"simpoints", required_argument, NULL, 'p'},
+        {"shards", required_argument, NULL, 'q'},
+        {"shard-check", no_argument, NULL, 'y'},
+        {"synth", required_argument, NULL, 'u'},
+        {NULL, 0, NULL, 0},
+    };
 
     /* Read arguments */
-    while(-1 != (opt = getopt(argc, argv, "i:I:2:3:4:c:C:s:S:t:T:fFvVlLoOhH"))) {
+    while(-1 != (opt = getopt_long(argc, argv, "i:I:c:C:s:S:t:T:fFvVlLoOhHdD", long_opts, NULL))) {
         switch(opt) {
         case 'i':
         case 'I':
-                trace[0] = fopen(optarg, "r");
-                if (trace[0] == NULL) {
-                    perror("fopen");
-                    printf("Could not open the input trace file\n");
-                    return 1;
-                }
-                //trace[1] = fopen(optarg, "r");
-                break;
-        case '2':
-            trace[1] = fopen(optarg, "r");
-            if (trace[1] == NULL) {
-                perror("fopen");
-                printf("Could not open the input trace file\n");
+            trace_path.push_back(optarg);
+            break;
+        case 'B':
+            convert_path = optarg;
+            break;
+        case 'W':
+            sweep_path = optarg;
+            break;
+        case 'P':
+            num_threads = atoi(optarg);
+            break;
+        case 'E':
+            config.dir_size = atoi(optarg);
+            break;
+        case 'M':
+            mrc = true;
+            break;
+        case 'N':
+            interval = strtoull(optarg, NULL, 0);
+            config.v = true;
+            break;
+        case 'J':
+            if (strcmp(optarg, "json") != 0 && strcmp(optarg, "csv") != 0) {
+                printf("Unknown interval format %s\n", optarg);
+                return 1;
+            }
+            interval_json = strcmp(optarg, "json") == 0;
+            config.v = true;
+            break;
+        case 'Q':
+            interval_path = optarg;
+            config.v = true;
+            break;
+        case 'A':
+            if (!parse_log2(optarg, &config.arity)) {
+                printf("--arity takes a whole number, the log2 of the size, got %s\n", optarg);
                 return 1;
             }
             break;
-        case '3':
-            trace[2] = fopen(optarg, "r");
-            if (trace[2] == NULL) {
-                perror("fopen");
-                printf("Could not open the input trace file\n");
+        case 'K':
+            if (!parse_log2(optarg, &config.block_size)) {
+                printf("--block-size takes a whole number, the log2 of the size, got %s\n", optarg);
                 return 1;
             }
             break;
-        case '4':
-            trace[3] = fopen(optarg, "r");
-            if (trace[3] == NULL) {
-                perror("fopen");
-                printf("Could not open the input trace file\n");
+        case 'G':
+            if (!parse_log2(optarg, &config.mem_size)) {
+                printf("--mem-size takes a whole number, the log2 of the size, got %s\n", optarg);
                 return 1;
             }
             break;
+        case 'X':
+            if (tag_match_parse(optarg, &config.tag_match) < 0) {
+                printf("Unknown tag match kernel %s\n", optarg);
+                return 1;
+            }
+            if (!tag_match_supported(config.tag_match)) {
+                printf("The CPU does not support the %s tag match kernel\n", optarg);
+                return 1;
+            }
+            break;
+        case 'Y':
+            return tag_match_bench() == 0 ? 0 : 1;
+        case 'R':
+            if (repl_parse(optarg, &config.repl) < 0) {
+                printf("Unknown replacement policy %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'U':
+            config.pin_levels = atoi(optarg);
+            break;
+        case 'Z':
+            config.pin_levels = atoi(optarg);
+            pin_report = true;
+            break;
+        case 'g':
+            config.timing = true;
+            break;
+        case 'm':
+            config.mshrs = atoi(optarg);
+            config.timing = true;
+            break;
+        case 'e':
+            config.dram_latency = atoi(optarg);
+            config.timing = true;
+            break;
+        case 'w':
+            config.dram_bw = atoi(optarg);
+            config.timing = true;
+            break;
+        case 'n':
+            config.coh_latency = atoi(optarg);
+            config.timing = true;
+            break;
+        case 'b':
+            checkpoint_path = optarg;
+            break;
+        case 'x':
+            checkpoint_at = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            restore_path = optarg;
+            break;
+        case 'a':
+            sample_plan.period = strtoull(optarg, NULL, 10);
+            break;
+        case 'j':
+            sample_plan.length = strtoull(optarg, NULL, 10);
+            break;
+        case 'k':
+            sample_warm = optarg;
+            break;
+        case 'p':
+            if (sample_parse_points(optarg, &sample_plan.points) < 0) {
+                return 1;
+            }
+            break;
+        case 'q':
+            num_shards = atoi(optarg);
+            break;
+        case 'y':
+            shard_check = true;
+            break;
+        case 'u':
+            if (workload_parse(optarg, &workload) < 0) {
+                return 1;
+            }
+            synthetic = true;
+            break;
         case 'c': // c
         case 'C':
             config.c = atoi(optarg);
@@ -88,103 +260,356 @@ int main(int argc, char **argv) {
         case 'T':
             config.write_thresh = atoi(optarg);
             break;
+        case 'd':
+        case 'D':
+            config.directory = true;
+            break;
         default:
             print_help();
             return 0;
         }
     }
-    if (trace[0] == NULL) {
-        perror("fopen");
-        printf("Could not open the input trace file");
+    // Traces after the options also add nodes
+    for (int i = optind; i < argc; i++) {
+        trace_path.push_back(argv[i]);
+    }
+    if (synthetic && !trace_path.empty()) {
+        printf("Give either trace files or a synthetic workload (--synth)\n");
+        return 1;
+    }
+    if (trace_path.empty() && !synthetic) {
+        printf("No input trace file given\n");
+        print_help();
+        return 1;
+    }
+    if (convert_path && synthetic) {
+        printf("Only trace files can be converted\n");
+        return 1;
+    }
+    if (convert_path) {
+        return trace_convert(trace_path[0], config.f, convert_path) == 0 ? 0 : 1;
+    }
+    if (trace_path.size() > MAX_NODES) {
+        printf("At most %d nodes (traces) are supported\n", MAX_NODES);
+        return 1;
+    }
+    if (config.v && interval == 0) {
+        printf("The interval must be at least one access\n");
+        return 1;
+    }
+    if (tree_check(&config)) {
+        printf("%s\n", tree_check(&config));
+        return 1;
+    }
+    if (config.timing && (config.mshrs == 0 || config.dram_bw == 0)) {
+        printf("The timing model needs at least one MSHR and a DRAM bandwidth of at least one byte per cycle\n");
+        return 1;
+    }
+    bool sampled = sample_plan.period || !sample_plan.points.empty();
+    if (sample_warm == NULL) {
+        sample_plan.warm = SAMPLE_WARM_WINDOWS * sample_plan.length;
+    } else if (strcmp(sample_warm, "all") == 0) {
+        sample_plan.warm = SAMPLE_WARM_ALL;
+    } else {
+        sample_plan.warm = strtoull(sample_warm, NULL, 10);
+    }
+    if (sample_plan.period && !sample_plan.points.empty()) {
+        printf("Sample either periodically (--sample) or at SimPoints (--simpoints)\n");
+        return 1;
+    }
+    if (sampled && (sample_plan.length == 0 || (sample_plan.period && sample_plan.period < sample_plan.length))) {
+        printf("Sample windows must be at least one access and the period at least one window\n");
+        return 1;
+    }
+    if (sampled && (config.v || checkpoint_path || restore_path)) {
+        printf("Sampling does not combine with -v, --checkpoint or --restore\n");
+        return 1;
+    }
+    if (shard_check && num_shards == 0) {
+        num_shards = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (num_shards && (config.v || checkpoint_path || restore_path || sampled)) {
+        printf("Sharding does not combine with -v, --checkpoint, --restore or sampling\n");
+        return 1;
+    }
+    if (num_shards && shard_unsupported(&config)) {
+        printf("Simulating serially, sharding is not supported: %s\n", shard_unsupported(&config));
+        num_shards = 0;
+        shard_check = false;
+    }
+    if (config.dir_size && (1ULL << config.dir_size) < DIR_WAYS) {
+        printf("The directory needs at least %d entries\n", DIR_WAYS);
         return 1;
     }
-    /// FIXME!!!! lazy hardcode for now.. will fix this later
-    if(NUM_NODES==2 && !trace[1]){
-        //trace[1]=fopen("/home/albert/its_traces/rand_access_t1.out", "r");
-        trace[1]=fopen("/home/albert/its_traces/rand_access_shorter.out", "r");
-        if (trace[1] == NULL) {
-            perror("fopen");
-            printf("Could not open the input trace1 file");
+    config.num_nodes = trace_path.size();
+    if (synthetic) {
+        config.num_nodes = workload.num_nodes;
+        workload_print(&workload);
+        for (uint64_t i = 0; i < workload.num_nodes; i++) {
+            trace.push_back(workload_open(&workload, i));
+        }
+    }
+    for (size_t i = 0; i < trace_path.size(); i++) {
+        trace.push_back(trace_open(trace_path[i], config.f));
+        if (trace[i] == NULL) {
+            printf("Could not open the input trace file for node %zu\n", i);
+            close_traces(trace);
             return 1;
         }
     }
-    
+    // Parse every trace on its own thread while the simulation runs, a single CPU would only
+    // switch between the readers and the simulation
+    if (std::thread::hardware_concurrency() > 1) {
+        for (size_t i = 0; i < trace.size(); i++) {
+            trace_start_reader(trace[i]);
+        }
+    }
+    if (sweep_path) {
+        int ret = sim_sweep(sweep_path, &config, trace.data(), num_threads);
+        close_traces(trace);
+        return ret == 0 ? 0 : 1;
+    }
+    if (pin_report) {
+        int ret = sim_pin_report(&config, trace.data(), num_threads, config.pin_levels);
+        close_traces(trace);
+        return ret == 0 ? 0 : 1;
+    }
+    if (mrc) {
+        int ret = sim_mrc(&config, trace.data());
+        close_traces(trace);
+        return ret == 0 ? 0 : 1;
+    }
 
-    /* Setup the cache */
 
-    sim_setup(cache_core, &config);
+    /* Setup the cache */
 
-    /* Setup statistics */
-    sim_stats_t stats[NUM_NODES];
-    for(int i=0; i<NUM_NODES;i++){
-        memset(&(stats[i]), 0, sizeof stats[i]);
-    }
+    sim_setup(&sim, &config);
+    sim_stats_t *stats = sim.stats.data();
     print_sim_config(&config);
+    if (sampled) {
+        sample_result_t result;
+        sim_sample(&sim, trace.data(), &sample_plan, &result);
+        sim_finish(&sim);
+        print_statistics_all_nodes(stats, sim.hist.data(), &config);
+        sample_print(&sim, &sample_plan, &result);
+        close_traces(trace);
+        return 0;
+    }
+    if (num_shards) {
+        int ret = sim_sharded(&sim, trace.data(), num_shards, shard_check);
+        sim_finish(&sim);
+        print_statistics_all_nodes(stats, sim.hist.data(), &config);
+        close_traces(trace);
+        return ret == 0 ? 0 : 1;
+    }
+    // Every node reads one trace entry per round, a checkpoint is taken between rounds
+    uint64_t accesses = 0;
+    uint64_t rounds = 0;
+    std::vector<uint64_t> records(config.num_nodes);
+    if (restore_path) {
+        if (sim_restore(&sim, restore_path, records.data(), &accesses) < 0) {
+            close_traces(trace);
+            return 1;
+        }
+        for (uint64_t i = 0; i < config.num_nodes; i++) {
+            if (trace_skip(trace[i], records[i]) < records[i]) {
+                printf("The trace of node %" PRIu64 " ends before the checkpoint\n", i);
+                close_traces(trace);
+                return 1;
+            }
+        }
+        rounds = records[0];
+    }
+    interval_log_t ilog;
+    if (config.v && interval_open(&ilog, interval_path, interval_json, interval, config.num_nodes) < 0) {
+        close_traces(trace);
+        return 1;
+    }
+    if (config.v && restore_path) {
+        interval_resume(&ilog, &sim, accesses);
+    }
     /* Begin reading the file */
     uint64_t address;
     int rw;
-    int count[NUM_NODES] = {0};
+    uint64_t next_sample = config.v ? ilog.next : UINT64_MAX;
     bool any_trace_done=false;
     while(!any_trace_done){
     //while (!feof(trace[0])) {
-        for(int i=0; i<NUM_NODES;i++){
-            int ret = 0;
-            if (config.f)
-                ret = fscanf(trace[i], "%d 0x%" PRIx64 "\n", &rw, &address);
-            else
-                ret = fscanf(trace[i], "0x%" PRIx64 " %d\n", &address, &rw);
-            if(ret == 2) {
-                sim_access(cache_core, i, (bool)rw, address, stats);
-                ++count[i];
-            } else {
-                char *line = NULL;
-                size_t len = 0;
-                int ret = getline(&line, &len, trace[i]);
-                assert(ret != 2);
-                // Skip line
+        for(uint64_t i=0; i<config.num_nodes;i++){
+            if(trace_read(trace[i], &address, &rw)) {
+                sim_access(&sim, i, (bool)rw, address);
+                if (++accesses == next_sample) {
+                    interval_sample(&ilog, &sim, accesses);
+                    next_sample = ilog.next;
+                }
             }
-            if (config.v && count[i] % (unsigned long long)10e5 == 0 && count[i]) {
-                printf("Node %d:\n",i);
-                any_trace_done = true;
-                compute_stats(&cache_core[i], &stats[i]);
-                print_statistics(&stats[i], &config);
-                break;
+        }
+        for(uint64_t i=0; i<config.num_nodes;i++){
+            if(trace_eof(trace[i])){
+                any_trace_done=true;
             }
         }
-        if (!any_trace_done) {
-            for(int i=0; i<NUM_NODES;i++){
-                if(feof(trace[i])){
-                    any_trace_done=true;
-                }
+        rounds++;
+        if (checkpoint_path && (accesses >= checkpoint_at || any_trace_done)) {
+            records.assign(config.num_nodes, rounds);
+            if (sim_checkpoint(&sim, checkpoint_path, records.data(), accesses) < 0) {
+                close_traces(trace);
+                return 1;
             }
+            checkpoint_path = NULL;
         }
     }
+    if (config.v) {
+        interval_close(&ilog, &sim, accesses);
+    }
+
+    sim_finish(&sim);
 
-    sim_finish(cache_core, stats);
+    print_statistics_all_nodes(stats, sim.hist.data(), &config);
 
-    print_statistics_all_nodes(stats, &config);
+    close_traces(trace);
 
     return 0;
 }
 
+static void close_traces(std::vector<trace_t *> &trace) {
+    for (size_t i = 0; i < trace.size(); i++) {
+        trace_close(trace[i]);
+    }
+    trace.clear();
+}
+
+// Parse a log2 geometry option, a plain decimal number and nothing else
+static bool parse_log2(const char *arg, uint64_t *value) {
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || strchr(arg, '-')) {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
 static void print_help(void) {
-    printf("cachesim [OPTIONS] -I traces/file.trace\n");
+    printf("cachesim [OPTIONS] -I traces/node0.trace [-I traces/node1.trace ...] [more traces]\n");
     printf("-h\t\tThis helpful output\n");
     printf("Metadata Cache parameters:\n");
     printf("  -c C\t\tTotal size for Metadata Cache in bytes is 2^C\n");
     printf("  -s S\t\tNumber of blocks (ways) per set for Metadata Cache is 2^S\n");
     printf("  -f F\t\tIf the trace has format (rw, addr)\n");
-    printf("  -v V\t\tPrint statistics every million accesses\n");
+    printf("  -v V\t\tLog the statistics of each node for every interval of accesses\n");
+    printf("  --interval N\tAccesses of all nodes per interval (default: 1000000), implies -v\n");
+    printf("  --interval-format csv|json\n\t\tWrite intervals as CSV (default) or JSON lines, implies -v\n");
+    printf("  --interval-out FILE\n\t\tWrite intervals to FILE instead of stdout, implies -v\n");
     printf("  -l L\t\tEnable lazy update\n");
+    printf("  --repl P\tReplacement policy: lru (default), plru, srrip, brrip or level (SRRIP keeping\n");
+    printf("\t\tupper tree levels longer)\n");
+    printf("Coherence:\n");
+    printf("  -d D\t\tUse a directory instead of snooping\n");
+    printf("  --dir-size N\tDirectory entries is 2^N (default: twice the blocks of all caches). A directory\n");
+    printf("\t\tset only holds blocks of the cache sets mapped to it: the cache set index and a hash\n");
+    printf("\t\tof the tag, or a hash of the cache set index if the directory has fewer sets\n");
+    printf("Timing:\n");
+    printf("  --timing\tModel verification latency in cycles on top of the functional simulation\n");
+    printf("  --mshrs N\tOutstanding fetches per node (default: %d), implies --timing\n", TIMING_MSHRS);
+    printf("  --dram-latency N\tCycles from the start of a DRAM transfer to its data (default: %d),\n",
+           TIMING_DRAM_LATENCY);
+    printf("\t\timplies --timing\n");
+    printf("  --dram-bw B\tBytes per cycle of the DRAM channel shared by all nodes (default: %d),\n", TIMING_DRAM_BW);
+    printf("\t\timplies --timing\n");
+    printf("  --coh-latency N\tCycles of one coherence message (default: %d), implies --timing\n",
+           TIMING_COH_LATENCY);
+    printf("Checkpoints:\n");
+    printf("  --checkpoint FILE\tSave the caches, coherence state, statistics and trace positions of the\n");
+    printf("\t\tsimulation to FILE, at the end of the traces unless --checkpoint-at is given\n");
+    printf("  --checkpoint-at N\tSave the checkpoint after N accesses of all nodes together, then keep going\n");
+    printf("  --restore FILE\tResume from a checkpoint saved with the same configuration and traces.\n");
+    printf("\t\tThe timing model is not saved and restarts at cycle 0\n");
+    printf("Sampling:\n");
+    printf("  --sample P\tSimulate a window of accesses in full every P accesses of each node and estimate\n");
+    printf("\t\tthe statistics of the run with 95%% confidence intervals. Statistics printed as usual\n");
+    printf("\t\tonly cover the windows\n");
+    printf("  --sample-len W\tAccesses of each node per window (default: %d)\n", SAMPLE_LENGTH);
+    printf("  --sample-warm N|all\tWarm the caches over the N accesses of each node before each window\n");
+    printf("\t\tand skip the others, or warm between all windows (default: %d windows)\n", SAMPLE_WARM_WINDOWS);
+    printf("  --simpoints FILE\tSimulate the windows listed in FILE instead, one \"index weight\" line\n");
+    printf("\t\teach, window i starting after i windows of accesses as with SimPoint\n");
+    printf("Parallel simulation:\n");
+    printf("  --shards N\tSplit the sets of every cache over N threads, with the same statistics as a serial\n");
+    printf("\t\trun. Eager updates with no timing model only, others run serially\n");
+    printf("  --shard-check\tAlso run the serial simulation and check the sharded one matches it\n");
+    printf("Integrity tree:\n");
+    printf("  --pin K\tKeep the top K tree levels below the root in a pinned on-chip buffer\n");
+    printf("  --pin-report K\tPrint the AAT and DRAM access savings of pinning 0 to K levels in one pass\n");
+    printf("  --arity A\tTree nodes have 2^A children (default: %d)\n", BLOCKS_PER_TOC_NODE);
+    printf("  --block-size B\tA leaf counter covers 2^B bytes of data (default: %d)\n", CPU_CACHE_BLOCK_SIZE);
+    printf("  --mem-size M\tThe tree protects 2^M bytes of memory (default: %d)\n", MAX_MEM_SIZE);
+    printf("  --tag-match K\tCompare tags with the auto (default), scalar, avx2 or avx512 kernel\n");
+    printf("  --tag-bench\tTime the tag compare kernels against scalar at each associativity and exit\n");
+    printf("Traces:\n");
+    printf("  -i FILE\tTrace of the next node, text or binary (detected from the header). One node is\n");
+    printf("\t\tsimulated per trace, given with -i or after the options, up to %d\n", MAX_NODES);
+    printf("\t\tTraces compressed with gzip, zstd or xz are decompressed on the fly\n");
+    printf("  --synth SPEC\tGenerate the accesses of every node instead of reading traces. SPEC is\n");
+    printf("\t\tPATTERN[:KEY=VALUE,...], PATTERN one of uniform, strided, zipf, migratory,\n");
+    printf("\t\tproducer-consumer or false-sharing. Keys: nodes (default 1), length (accesses per\n");
+    printf("\t\tnode, default %d), footprint (bytes, default 1G), writes (ratio, default 0.3),\n",
+           WORKLOAD_LENGTH);
+    printf("\t\tseed, stride (strided), theta (zipf skew in (0, 1), default 0.99), object (migratory),\n");
+    printf("\t\tlag (producer-consumer, default 0) and chunk (false-sharing, default 512).\n");
+    printf("\t\tSizes take a K, M or G suffix\n");
+    printf("  --convert OUT\tConvert the text trace given with -i (-f for (rw, addr)) to binary OUT and exit\n");
+    printf("Sweeps:\n");
+    printf("  --sweep FILE\tSimulate every configuration of FILE, one line of -c/-s/-l/-o/-h/-t/-d flags each,\n");
+    printf("\t\tin one pass over the traces and print one CSV row per configuration\n");
+    printf("  --threads N\tWorker threads for --sweep and --pin-report (default: one per CPU)\n");
+    printf("  --mrc\t\tPrint LRU miss-ratio curves of every cache up to 2^C bytes and 2^%d ways per tree\n", MRC_MAX_S);
+    printf("\t\tlevel, from the stack distances of one pass over the full tree walks\n");
 }
 
 static void print_sim_config(sim_config_t *sim_config) {
+    for (uint64_t i = 0; i < sim_config->num_nodes; i++) {
+        std::cout << (sim_config->eager ? "eager" : "lazy") << std::endl;
+    }
+    std::cout << sim_config->mem_size - sim_config->block_size << " " << tree_levels(sim_config) << std::endl;
+    if (sim_config->hybrid_coh) {
+        std::cout << sim_config->write_thresh << std::endl;
+    }
+    if (sim_config->pin_levels) {
+        tree_geometry_t tree;
+        tree_setup(&tree, sim_config);
+        std::cout << "pinned " << sim_config->pin_levels << " levels " << tree_pinned_blocks(&tree) << " blocks"
+                  << std::endl;
+        tree_free(&tree);
+    }
+    if (sim_config->timing) {
+        std::cout << "timing " << sim_config->mshrs << " mshrs, dram " << sim_config->dram_latency << " cycles "
+                  << sim_config->dram_bw << " B/cycle, coherence " << sim_config->coh_latency << " cycles"
+                  << std::endl;
+    }
+    if (sim_config->repl != REPL_LRU) {
+        std::cout << "replacement " << repl_name(sim_config->repl) << std::endl;
+    }
+    if (sim_config->directory) {
+        std::cout << "directory";
+        if (sim_config->dir_size) {
+            std::cout << " " << (1ULL << sim_config->dir_size) << " entries";
+        }
+        std::cout << std::endl;
+    }
     printf("(C,S): (%" PRIu64 " KiB,%" PRIu64 " way)\n",
         (1UL << sim_config->c)/1024, (1UL << sim_config->s)
     );
 }
 
-static void print_statistics(sim_stats_t* stats, sim_config_t *config) {
+static void print_hist_row(const char *name, const hist_t *hist) {
+    printf("%-15s %10.2f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n", name,
+           hist_mean(hist), hist_percentile(hist, 0.5), hist_percentile(hist, 0.9), hist_percentile(hist, 0.99),
+           hist_percentile(hist, 0.999), hist->max);
+}
+
+static void print_statistics(sim_stats_t* stats, sim_hist_t *hist, sim_config_t *config) {
     printf("Cache Statistics\n");
     printf("----------------\n");
     printf("Reads: %" PRIu64 "\n", stats->reads);
@@ -198,20 +623,52 @@ static void print_statistics(sim_stats_t* stats, sim_config_t *config) {
     printf("Metadata Cache hit ratio: %.3f\n", stats->hit_ratio_l1);
     printf("Metadata Cache miss ratio: %.3f\n", stats->miss_ratio_l1);
     printf("Metadata Cache writebacks due user level conflicts: %" PRIu64 "\n", stats->writebacks_l1);
+    printf("Metadata Cache resident entries: %" PRIu64 "\n", stats->resident_entries);
+    printf("Metadata Cache blocks listed by coherence: %" PRIu64 "\n", stats->coherence_entries);
     //printf("Metadata Cache average access time (AAT): %.3f\n", stats->avg_access_time);
     printf("Average level for verification hit: %.2f\n", stats->avg_level);
     printf("\n");
     printf("Metadata inval messages: %" PRIu64 "\n", stats->num_inval_msgs);
     printf("Metadata block transfers: %" PRIu64 "\n", stats->num_block_transfer);
     printf("Metadata writebacks from modify to shared: %" PRIu64 "\n", stats->num_wb_from_m2s);
+    if (config->directory) {
+        printf("Directory lookups: %" PRIu64 "\n", stats->num_dir_lookups);
+        printf("Directory evictions: %" PRIu64 "\n", stats->num_dir_evictions);
+        printf("Directory messages: %" PRIu64 "\n", stats->num_dir_msgs);
+    }
+    if (config->pin_levels) {
+        printf("Pinned buffer accesses: %" PRIu64 "\n", stats->num_pinned_accesses);
+    }
     printf("Total DRAM accesses: %" PRIu64 "\n", stats->num_dram_accesses);
     printf("Total transitions to Single Owner: %" PRIu64 "\n", stats->num_single_owner_set);
     printf("Total transitions from Single Owner: %" PRIu64 "\n", stats->num_single_owner_unset);
+    printf("Maximum lazy propagation cascade depth: %" PRIu64 "\n", stats->max_cascade_depth);
+    if (config->timing) {
+        printf("Cycles: %" PRIu64 "\n", stats->cycles);
+        printf("DRAM channel transfers: %" PRIu64 "\n", stats->dram_transfers);
+        printf("DRAM channel queueing delay mean: %.2f cycles\n", stats->avg_dram_queue_delay);
+    }
+    printf("\n");
+    printf("Level   Accesses       Hits     Misses  Evictions  Dirty evictions  Lazy propagations  Verified at level\n");
+    for (uint64_t l = 0; l < tree_levels(config); l++) {
+        const sim_level_stats_t *lv = &stats->level[l];
+        printf("%5" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %16" PRIu64 " %18" PRIu64
+               " %18" PRIu64 "\n", l, lv->accesses, lv->hits, lv->misses, lv->evictions, lv->dirty_evictions,
+               lv->lazy_propagations, stats->verify_depth[l]);
+    }
+    printf("\n");
+    printf("Per access            Mean        p50        p90        p99      p99.9        Max\n");
+    print_hist_row("Levels walked", &hist->levels);
+    print_hist_row("Cache accesses", &hist->cache_accesses);
+    print_hist_row("DRAM accesses", &hist->dram_accesses);
+    if (config->timing) {
+        print_hist_row("Cycles", &hist->cycles);
+    }
     printf("\n");
 }
-static void print_statistics_all_nodes(sim_stats_t* stats, sim_config_t *config) {
-    for(int i=0;i<NUM_NODES;i++){
-        printf("Node %d:\n",i);
-        print_statistics(&(stats[i]),config);
+static void print_statistics_all_nodes(sim_stats_t* stats, sim_hist_t *hist, sim_config_t *config) {
+    for(uint64_t i=0;i<config->num_nodes;i++){
+        printf("Node %" PRIu64 ":\n",i);
+        print_statistics(&(stats[i]), &hist[i], config);
     }
 }
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include "checkpoint.hpp"
+
+typedef struct ckpt_section {
+    void *data;
+    size_t size;
+} ckpt_section_t;
+
+static inline size_t ckpt_align(size_t size) {
+    return (size + CKPT_ALIGN - 1) & ~(size_t)(CKPT_ALIGN - 1);
+}
+
+// Arrays of the checkpoint after the header, in file order
+static std::vector<ckpt_section_t> ckpt_sections(sim_t *sim, uint64_t *records, uint64_t *clocks) {
+    std::vector<ckpt_section_t> sections;
+    uint64_t num_nodes = sim->num_nodes;
+    sections.push_back({records, num_nodes * sizeof *records});
+    sections.push_back({clocks, num_nodes * sizeof *clocks});
+    sections.push_back({sim->stats.data(), num_nodes * sizeof(sim_stats_t)});
+    sections.push_back({sim->hist.data(), num_nodes * sizeof(sim_hist_t)});
+    for (uint64_t i = 0; i < num_nodes; i++) {
+        cache_t *cache = &sim->cache[i];
+        uint64_t num_sets = 1ULL << cache->idx;
+        uint64_t num_blocks = num_sets << cache->s;
+        sections.push_back({cache->tags, num_blocks * sizeof *cache->tags});
+        sections.push_back({cache->blocks, num_blocks * sizeof *cache->blocks});
+        sections.push_back({cache->repl, num_blocks * sizeof *cache->repl});
+        sections.push_back({cache->set_entries, num_sets * sizeof *cache->set_entries});
+    }
+    if (sim->directory) {
+        sections.push_back({sim->dir.entries, (sim->dir.set_mask + 1) * DIR_WAYS * sizeof *sim->dir.entries});
+    } else {
+        sections.push_back({sim->sharers.entries, (sim->sharers.mask + 1) * sizeof *sim->sharers.entries});
+    }
+    return sections;
+}
+
+static void ckpt_fill_header(const sim_t *sim, ckpt_header_t *header) {
+    memset(header, 0, sizeof *header);
+    memcpy(header->magic, CKPT_MAGIC, sizeof header->magic);
+    header->version = CKPT_VERSION;
+    header->header_size = sizeof *header;
+    header->entry_size = sizeof(cache_entry_t);
+    header->stats_size = sizeof(sim_stats_t);
+    header->hist_size = sizeof(sim_hist_t);
+    header->dir_entry_size = sizeof(dir_entry_t);
+    header->config = sim->config;
+    header->num_sets = 1ULL << sim->cache[0].idx;
+    header->num_ways = 1ULL << sim->cache[0].s;
+    header->table_entries = sim->directory ? (sim->dir.set_mask + 1) * DIR_WAYS : sim->sharers.mask + 1;
+    header->dir_lru_clock = sim->directory ? sim->dir.lru_clock : 0;
+}
+
+/**
+ * @brief Save the state of a simulation between two rounds of accesses
+ *
+ * @param records Entries consumed from the trace of each node
+ * @param accesses Accesses of all nodes simulated so far
+ * @return 0 on success, -1 on error
+ */
+int sim_checkpoint(const sim_t *sim, const char *path, const uint64_t *records, uint64_t accesses) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    std::vector<uint64_t> record_copy(records, records + sim->num_nodes);
+    std::vector<uint64_t> clocks(sim->num_nodes);
+    for (uint64_t i = 0; i < sim->num_nodes; i++) {
+        clocks[i] = sim->cache[i].repl_clock;
+    }
+    // Sections are only read from here on
+    std::vector<ckpt_section_t> sections = ckpt_sections((sim_t *)sim, record_copy.data(), clocks.data());
+    ckpt_header_t header;
+    ckpt_fill_header(sim, &header);
+    header.accesses = accesses;
+    header.file_size = ckpt_align(sizeof header);
+    for (const auto &section : sections) {
+        header.file_size += ckpt_align(section.size);
+    }
+    static const char pad[CKPT_ALIGN] = {0};
+    bool ok = fwrite(&header, sizeof header, 1, file) == 1 &&
+              fwrite(pad, ckpt_align(sizeof header) - sizeof header, 1, file) <= 1;
+    for (size_t i = 0; ok && i < sections.size(); i++) {
+        ok = fwrite(sections[i].data, 1, sections[i].size, file) == sections[i].size &&
+             fwrite(pad, 1, ckpt_align(sections[i].size) - sections[i].size, file) ==
+             ckpt_align(sections[i].size) - sections[i].size;
+    }
+    if (!ok) {
+        perror("fwrite");
+    }
+    if (fclose(file) != 0) {
+        perror("fclose");
+        ok = false;
+    }
+    return ok ? 0 : -1;
+}
+
+// Configuration fields that fix the layout or meaning of the saved state
+static const char *ckpt_mismatch(const sim_config_t *saved, const sim_config_t *config) {
+    if (saved->num_nodes != config->num_nodes) {
+        return "number of nodes";
+    }
+    if (saved->c != config->c || saved->s != config->s) {
+        return "cache geometry";
+    }
+    if (saved->directory != config->directory || saved->dir_size != config->dir_size) {
+        return "coherence";
+    }
+    if (saved->arity != config->arity || saved->block_size != config->block_size ||
+        saved->mem_size != config->mem_size || saved->pin_levels != config->pin_levels) {
+        return "tree geometry";
+    }
+    if (saved->repl != config->repl) {
+        return "replacement policy";
+    }
+    if (saved->eager != config->eager || saved->single_owner != config->single_owner ||
+        saved->hybrid_coh != config->hybrid_coh || saved->write_thresh != config->write_thresh) {
+        return "update policy";
+    }
+    return NULL;
+}
+
+/**
+ * @brief Load a checkpoint into a simulation set up with a compatible configuration
+ *
+ * The file is mapped and every array copied in one go. Timing model state is not saved, a timed run
+ * restarts its clocks at cycle 0 with the warmed caches.
+ *
+ * @param records Filled with the entries to skip in the trace of each node
+ * @param accesses Filled with the accesses of all nodes simulated before the checkpoint
+ * @return 0 on success, -1 on error
+ */
+int sim_restore(sim_t *sim, const char *path, uint64_t *records, uint64_t *accesses) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(ckpt_header_t)) {
+        fprintf(stderr, "%s: not a checkpoint or truncated\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    const ckpt_header_t *saved = (const ckpt_header_t *)map;
+    ckpt_header_t expected;
+    ckpt_fill_header(sim, &expected);
+    const char *mismatch = NULL;
+    if (memcmp(saved->magic, CKPT_MAGIC, sizeof saved->magic) != 0 || saved->version != CKPT_VERSION) {
+        mismatch = "format";
+    } else if (saved->header_size != expected.header_size || saved->entry_size != expected.entry_size ||
+               saved->stats_size != expected.stats_size || saved->hist_size != expected.hist_size ||
+               saved->dir_entry_size != expected.dir_entry_size) {
+        mismatch = "build layout";
+    } else if (saved->file_size != (uint64_t)st.st_size) {
+        mismatch = "file size";
+    } else {
+        mismatch = ckpt_mismatch(&saved->config, &sim->config);
+    }
+    if (mismatch == NULL && (saved->num_sets != expected.num_sets || saved->num_ways != expected.num_ways ||
+                             saved->table_entries != expected.table_entries)) {
+        mismatch = "table sizes";
+    }
+    if (mismatch) {
+        fprintf(stderr, "%s: checkpoint %s does not match\n", path, mismatch);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    std::vector<uint64_t> clocks(sim->num_nodes);
+    const char *src = (const char *)map + ckpt_align(sizeof *saved);
+    for (const auto &section : ckpt_sections(sim, records, clocks.data())) {
+        memcpy(section.data, src, section.size);
+        src += ckpt_align(section.size);
+    }
+    for (uint64_t i = 0; i < sim->num_nodes; i++) {
+        sim->cache[i].repl_clock = clocks[i];
+    }
+    if (sim->directory) {
+        sim->dir.lru_clock = saved->dir_lru_clock;
+    }
+    *accesses = saved->accesses;
+    munmap(map, st.st_size);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "cachesim.hpp"
+
+// Checkpoint layout: a ckpt_header_t, the records consumed from each trace, then the raw arrays of the
+// simulator state (per-node caches, statistics and histograms, then the sharer table or directory),
+// each starting on a CKPT_ALIGN boundary so they are restored with one copy each.
+#define CKPT_MAGIC "ITSCKPT"
+#define CKPT_VERSION 1
+#define CKPT_ALIGN 64
+
+typedef struct ckpt_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    // Sizes of the structures copied as is, a checkpoint only loads into the same build layout
+    uint32_t entry_size;
+    uint32_t stats_size;
+    uint32_t hist_size;
+    uint32_t dir_entry_size;
+    sim_config_t config;
+    uint64_t accesses;              // Accesses of all nodes simulated before the checkpoint
+    uint64_t num_sets;              // Per node
+    uint64_t num_ways;
+    uint64_t table_entries;         // Sharer table slots or directory entries
+    uint64_t dir_lru_clock;
+    uint64_t file_size;
+} ckpt_header_t;
+
+extern int sim_checkpoint(const sim_t *sim, const char *path, const uint64_t *records, uint64_t accesses);
+extern int sim_restore(sim_t *sim, const char *path, uint64_t *records, uint64_t *accesses);
+
+#endif /* CHECKPOINT_HPP */
@@ -0,0 +1,45 @@
+#include <algorithm>
+#include "hist.hpp"
+
+// Largest value counted in a bucket
+static uint64_t hist_bucket_high(uint64_t index) {
+    if (index < HIST_SUB) {
+        return index;
+    }
+    uint64_t shift = (index >> HIST_SUB_BITS) - 1;
+    uint64_t low = (HIST_SUB + (index & (HIST_SUB - 1))) << shift;
+    return low + ((1ULL << shift) - 1);
+}
+
+/**
+ * @brief Value within which a fraction p of the recorded values fall, up to the bucket precision
+ *
+ * @return The largest value of the bucket holding that rank, never above the largest value recorded
+ */
+uint64_t hist_percentile(const hist_t *hist, double p) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::min<uint64_t>((uint64_t)(p * hist->count), hist->count - 1);
+    uint64_t seen = 0;
+    for (uint64_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen > rank) {
+            return std::min(hist_bucket_high(i), hist->max);
+        }
+    }
+    return hist->max;
+}
+
+double hist_mean(const hist_t *hist) {
+    return hist->count ? hist->sum * 1.0 / hist->count : 0;
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+    dst->count += src->count;
+    dst->sum += src->sum;
+    dst->max = std::max(dst->max, src->max);
+    for (uint64_t i = 0; i < HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef HIST_HPP
+#define HIST_HPP
+
+#include <stdint.h>
+
+// Log-linear histogram of 64-bit values, as HDR histograms: values below 2^HIST_SUB_BITS are counted
+// exactly, larger ones in 2^HIST_SUB_BITS linear buckets per power of two, a relative error of at most
+// 2^-HIST_SUB_BITS. Memory is fixed and recording takes a handful of instructions.
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1ULL << HIST_SUB_BITS)
+#define HIST_BUCKETS ((65 - HIST_SUB_BITS) << HIST_SUB_BITS)
+
+typedef struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+static inline uint64_t hist_index(uint64_t v) {
+    if (v < HIST_SUB) {
+        return v;
+    }
+    uint64_t e = 63 - __builtin_clzll(v);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static inline void hist_record(hist_t *hist, uint64_t v) {
+    hist->count++;
+    hist->sum += v;
+    hist->max = v > hist->max ? v : hist->max;
+    hist->buckets[hist_index(v)]++;
+}
+
+extern uint64_t hist_percentile(const hist_t *hist, double p);
+extern double hist_mean(const hist_t *hist);
+extern void hist_merge(hist_t *dst, const hist_t *src);
+
+#endif /* HIST_HPP */
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "interval.hpp"
+
+static void interval_flush(interval_log_t *log) {
+    if (log->buf_len && fwrite(log->buf, 1, log->buf_len, log->out) != log->buf_len) {
+        perror("fwrite");
+    }
+    log->buf_len = 0;
+}
+
+/**
+ * @brief Start logging interval statistics
+ *
+ * @param path Output file, NULL for stdout
+ * @param json JSON lines instead of CSV
+ * @param length Accesses of all nodes per interval
+ * @return 0 on success, -1 on error
+ */
+int interval_open(interval_log_t *log, const char *path, bool json, uint64_t length, uint64_t num_nodes) {
+    log->out = stdout;
+    if (path) {
+        log->out = fopen(path, "w");
+        if (log->out == NULL) {
+            perror("fopen");
+            return -1;
+        }
+    }
+    log->json = json;
+    log->length = length;
+    log->next = length;
+    log->num_intervals = 0;
+    log->last = 0;
+    log->prev.assign(num_nodes, sim_stats_t());
+    log->buf = new char[INTERVAL_BUF_SIZE];
+    log->buf_len = 0;
+    if (!json) {
+        log->buf_len = snprintf(log->buf, INTERVAL_BUF_SIZE,
+                                "interval,accesses,node,reads,writes,cache_accesses,hits,misses,hit_ratio,"
+                                "writebacks,dram_accesses,inval_msgs,block_transfers,wb_from_m2s,avg_level\n");
+    }
+    return 0;
+}
+
+static void interval_row(interval_log_t *log, uint64_t accesses, uint64_t node_id, const sim_stats_t *cur) {
+    const sim_stats_t *prev = &log->prev[node_id];
+    uint64_t reads = cur->reads - prev->reads;
+    uint64_t writes = cur->writes - prev->writes;
+    uint64_t cache_accesses = cur->accesses_l1 - prev->accesses_l1;
+    uint64_t hits = cur->hits_l1 - prev->hits_l1;
+    uint64_t misses = cur->misses_l1 - prev->misses_l1;
+    uint64_t writebacks = cur->writebacks_l1 - prev->writebacks_l1;
+    uint64_t dram_accesses = cur->num_dram_accesses - prev->num_dram_accesses;
+    uint64_t inval_msgs = cur->num_inval_msgs - prev->num_inval_msgs;
+    uint64_t block_transfers = cur->num_block_transfer - prev->num_block_transfer;
+    uint64_t wb_from_m2s = cur->num_wb_from_m2s - prev->num_wb_from_m2s;
+    double hit_ratio = cache_accesses ? hits * 1.0 / cache_accesses : 0;
+    double avg_level = reads + writes ? (cur->total_levels - prev->total_levels) * 1.0 / (reads + writes) : 0;
+    const char *fmt = log->json ?
+        "{\"interval\":%" PRIu64 ",\"accesses\":%" PRIu64 ",\"node\":%" PRIu64 ",\"reads\":%" PRIu64
+        ",\"writes\":%" PRIu64 ",\"cache_accesses\":%" PRIu64 ",\"hits\":%" PRIu64 ",\"misses\":%" PRIu64
+        ",\"hit_ratio\":%.4f,\"writebacks\":%" PRIu64 ",\"dram_accesses\":%" PRIu64 ",\"inval_msgs\":%" PRIu64
+        ",\"block_transfers\":%" PRIu64 ",\"wb_from_m2s\":%" PRIu64 ",\"avg_level\":%.3f}\n" :
+        "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+        ",%.4f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f\n";
+    if (INTERVAL_BUF_SIZE - log->buf_len < INTERVAL_ROW_MAX) {
+        interval_flush(log);
+    }
+    log->buf_len += snprintf(log->buf + log->buf_len, INTERVAL_ROW_MAX, fmt, log->num_intervals, accesses, node_id,
+                             reads, writes, cache_accesses, hits, misses, hit_ratio, writebacks, dram_accesses,
+                             inval_msgs, block_transfers, wb_from_m2s, avg_level);
+    log->prev[node_id] = *cur;
+}
+
+/**
+ * @brief Continue the intervals of a run restored from a checkpoint taken after accesses. The first
+ * interval only covers the accesses from the checkpoint on, later ones match the uninterrupted run.
+ */
+void interval_resume(interval_log_t *log, const sim_t *sim, uint64_t accesses) {
+    log->prev.assign(sim->stats.begin(), sim->stats.end());
+    log->num_intervals = accesses / log->length;
+    log->last = accesses;
+    log->next = (log->num_intervals + 1) * log->length;
+}
+
+/**
+ * @brief End the current interval, called once accesses reaches log->next. Rows are only formatted
+ * into the buffer here, it is written out when full.
+ */
+void interval_sample(interval_log_t *log, const sim_t *sim, uint64_t accesses) {
+    for (uint64_t i = 0; i < sim->num_nodes; i++) {
+        interval_row(log, accesses, i, &sim->stats[i]);
+    }
+    log->num_intervals++;
+    log->last = accesses;
+    log->next = accesses + log->length;
+}
+
+/**
+ * @brief Log the last, partial interval and write everything out
+ */
+void interval_close(interval_log_t *log, const sim_t *sim, uint64_t accesses) {
+    if (accesses > log->last) {
+        interval_sample(log, sim, accesses);
+    }
+    interval_flush(log);
+    if (log->out != stdout) {
+        fclose(log->out);
+    } else {
+        fflush(stdout);
+    }
+    delete[] log->buf;
+}
@@ -0,0 +1,29 @@
+#ifndef INTERVAL_HPP
+#define INTERVAL_HPP
+
+#include <stdio.h>
+#include <vector>
+#include "cachesim.hpp"
+
+#define INTERVAL_BUF_SIZE (64 * 1024)   // Formatted rows are buffered up to this many bytes
+#define INTERVAL_ROW_MAX 512            // Longest row of one node for one interval
+
+// Per-node statistics of every interval of a run, written as CSV or JSON lines
+typedef struct interval_log {
+    FILE *out;
+    bool json;
+    uint64_t length;                    // Accesses (all nodes) per interval
+    uint64_t next;                      // Access count ending the current interval
+    uint64_t num_intervals;
+    uint64_t last;                      // Access count at the end of the previous interval
+    std::vector<sim_stats_t> prev;      // Statistics at the end of the previous interval
+    char *buf;                          // Rows not written out yet
+    size_t buf_len;
+} interval_log_t;
+
+extern int interval_open(interval_log_t *log, const char *path, bool json, uint64_t length, uint64_t num_nodes);
+extern void interval_resume(interval_log_t *log, const sim_t *sim, uint64_t accesses);
+extern void interval_sample(interval_log_t *log, const sim_t *sim, uint64_t accesses);
+extern void interval_close(interval_log_t *log, const sim_t *sim, uint64_t accesses);
+
+#endif /* INTERVAL_HPP */
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include "mrc.hpp"
+
+// Buckets of the stack distance histograms: bucket s holds the distances that hit with 2^s ways but
+// not with fewer, the last bucket the cold misses and distances past every tracked way.
+#define MRC_BUCKETS (MRC_MAX_S + 2)
+
+// LRU stacks of every set of one node's cache for one set count, cut at the largest tracked way
+typedef struct mrc_stack {
+    uint64_t *blocks;               // Sets x depth, most recently used first, INVALID_TAG if empty
+    uint64_t set_mask;
+    uint64_t depth;
+} mrc_stack_t;
+
+typedef struct mrc {
+    uint64_t num_nodes;
+    uint64_t num_set_counts;        // Set counts 2^0 .. 2^(num_set_counts - 1)
+    uint64_t levels;                // Cached tree levels, the root and pinned levels are never cached
+    tree_geometry_t tree;
+    std::vector<mrc_stack_t> stacks;    // num_nodes x num_set_counts
+    std::vector<uint64_t> refs;         // References per level
+    std::vector<uint64_t> dist;         // num_set_counts x levels x MRC_BUCKETS
+} mrc_t;
+
+static void mrc_setup(mrc_t *mrc, const sim_config_t *config) {
+    uint64_t max_blocks_log = config->c - METADATA_BLOCK_SIZE;
+    mrc->num_nodes = config->num_nodes;
+    mrc->num_set_counts = max_blocks_log + 1;
+    tree_setup(&mrc->tree, config);
+    mrc->levels = mrc->tree.pin_level;
+    for (uint64_t i = 0; i < mrc->num_nodes; i++) {
+        for (uint64_t k = 0; k < mrc->num_set_counts; k++) {
+            // 2^k sets are only used with up to 2^(max_blocks_log - k) ways
+            mrc_stack_t stack;
+            stack.set_mask = (1ULL << k) - 1;
+            stack.depth = 1ULL << std::min<uint64_t>(MRC_MAX_S, max_blocks_log - k);
+            uint64_t num_blocks = (1ULL << k) * stack.depth;
+            stack.blocks = new uint64_t[num_blocks];
+            std::fill_n(stack.blocks, num_blocks, INVALID_TAG);
+            mrc->stacks.push_back(stack);
+        }
+    }
+    mrc->refs.assign(mrc->levels, 0);
+    mrc->dist.assign(mrc->num_set_counts * mrc->levels * MRC_BUCKETS, 0);
+}
+
+static void mrc_finish(mrc_t *mrc) {
+    for (auto &stack : mrc->stacks) {
+        delete[] stack.blocks;
+    }
+    tree_free(&mrc->tree);
+}
+
+/**
+ * @brief Reference a block in the LRU stack of its set
+ *
+ * @return Stack distance of the block, or the stack depth if it was not in the stack
+ */
+static inline uint64_t mrc_stack_ref(mrc_stack_t *stack, uint64_t pfn) {
+    uint64_t *set = stack->blocks + (pfn & stack->set_mask) * stack->depth;
+    uint64_t d = 0;
+    while (d < stack->depth && set[d] != pfn) {
+        d++;
+    }
+    memmove(set + 1, set, std::min(d, stack->depth - 1) * sizeof *set);
+    set[0] = pfn;
+    return d;
+}
+
+static inline uint64_t mrc_bucket(uint64_t d, uint64_t depth) {
+    if (d == depth) {
+        return MRC_BUCKETS - 1;
+    }
+    return d == 0 ? 0 : 64 - __builtin_clzll(d);
+}
+
+// Walk the tree from the leaf to the root for one access, every level is referenced
+static void mrc_access(mrc_t *mrc, uint64_t node_id, uint64_t addr) {
+    uint64_t pfn = (addr >> mrc->tree.block_size) & mrc->tree.pfn_mask;
+    mrc_stack_t *stacks = &mrc->stacks[node_id * mrc->num_set_counts];
+    for (uint32_t level = 0; level < mrc->levels; level++) {
+        uint64_t metadata_pfn = tree_metadata_pfn<0>(&mrc->tree, level, pfn);
+        mrc->refs[level]++;
+        for (uint64_t k = 0; k < mrc->num_set_counts; k++) {
+            uint64_t d = mrc_stack_ref(&stacks[k], metadata_pfn);
+            mrc->dist[(k * mrc->levels + level) * MRC_BUCKETS + mrc_bucket(d, stacks[k].depth)]++;
+        }
+    }
+}
+
+static uint64_t mrc_misses(const mrc_t *mrc, uint64_t k, uint32_t level, uint64_t s) {
+    const uint64_t *dist = &mrc->dist[(k * mrc->levels + level) * MRC_BUCKETS];
+    uint64_t misses = 0;
+    for (uint64_t b = s + 1; b < MRC_BUCKETS; b++) {
+        misses += dist[b];
+    }
+    return misses;
+}
+
+static void print_mrc(const mrc_t *mrc) {
+    printf("c,s,level,refs,misses,miss_ratio\n");
+    for (uint64_t blocks_log = 0; blocks_log < mrc->num_set_counts; blocks_log++) {
+        uint64_t c = blocks_log + METADATA_BLOCK_SIZE;
+        for (uint64_t s = 0; s <= std::min<uint64_t>(MRC_MAX_S, blocks_log); s++) {
+            uint64_t k = blocks_log - s;
+            uint64_t refs = 0, misses = 0;
+            for (uint32_t level = 0; level < mrc->levels; level++) {
+                refs += mrc->refs[level];
+                misses += mrc_misses(mrc, k, level, s);
+            }
+            printf("%" PRIu64 ",%" PRIu64 ",all,%" PRIu64 ",%" PRIu64 ",%.4f\n", c, s, refs, misses,
+                   misses * 1.0 / refs);
+            for (uint32_t level = 0; level < mrc->levels; level++) {
+                misses = mrc_misses(mrc, k, level, s);
+                printf("%" PRIu64 ",%" PRIu64 ",%u,%" PRIu64 ",%" PRIu64 ",%.4f\n", c, s, level, mrc->refs[level],
+                       misses, misses * 1.0 / mrc->refs[level]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Miss-ratio curves of every cache up to 2^config->c bytes in one pass over the traces
+ *
+ * Every access references its metadata block at each level up to the root, the stream an eager write
+ * generates. LRU stack distances of that stream are kept per node for every power of two set count,
+ * giving the misses of every capacity and associativity (up to 2^MRC_MAX_S ways) at once. The walk
+ * stopping at the first hit and coherence between nodes are not modelled, confirm the chosen sizes
+ * with --sweep. One CSV row is printed per capacity, associativity and tree level, summed over nodes.
+ *
+ * @return 0 on success, -1 on error
+ */
+int sim_mrc(const sim_config_t *config, trace_t **trace) {
+    if (config->c < METADATA_BLOCK_SIZE) {
+        fprintf(stderr, "Cache smaller than one block\n");
+        return -1;
+    }
+    mrc_t mrc;
+    mrc_setup(&mrc, config);
+    uint64_t address;
+    int rw;
+    bool any_trace_done = false;
+    while (!any_trace_done) {
+        for (uint64_t i = 0; i < config->num_nodes; i++) {
+            if (trace_read(trace[i], &address, &rw)) {
+                mrc_access(&mrc, i, address);
+            }
+        }
+        for (uint64_t i = 0; i < config->num_nodes; i++) {
+            if (trace_eof(trace[i])) {
+                any_trace_done = true;
+            }
+        }
+    }
+    print_mrc(&mrc);
+    mrc_finish(&mrc);
+    return 0;
+}
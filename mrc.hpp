@@ -0,0 +1,11 @@
+#ifndef MRC_HPP
+#define MRC_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+#define MRC_MAX_S 6                     // Largest associativity of the curves is 2^MRC_MAX_S ways
+
+extern int sim_mrc(const sim_config_t *config, trace_t **trace);
+
+#endif /* MRC_HPP */
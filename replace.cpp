@@ -0,0 +1,21 @@
+#include <string.h>
+#include "replace.hpp"
+
+static const char *const repl_names[] = {"lru", "plru", "srrip", "brrip", "level"};
+
+const char *repl_name(repl_policy_t policy) {
+    return repl_names[policy];
+}
+
+/**
+ * @return 0 if name is a replacement policy, -1 otherwise
+ */
+int repl_parse(const char *name, repl_policy_t *policy) {
+    for (int p = REPL_LRU; p <= REPL_LEVEL; p++) {
+        if (strcmp(name, repl_names[p]) == 0) {
+            *policy = (repl_policy_t)p;
+            return 0;
+        }
+    }
+    return -1;
+}
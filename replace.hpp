@@ -0,0 +1,108 @@
+#ifndef REPLACE_HPP
+#define REPLACE_HPP
+
+#include <stdint.h>
+
+typedef enum {
+    REPL_LRU,                       // True LRU
+    REPL_PLRU,                      // Tree pseudo-LRU
+    REPL_SRRIP,                     // Static re-reference interval prediction
+    REPL_BRRIP,                     // Bimodal RRIP, most fills predicted distant
+    REPL_LEVEL,                     // SRRIP with fills of upper tree levels predicted nearer
+} repl_policy_t;
+
+#define RRIP_MAX 3                      // 2-bit re-reference prediction values
+#define BRRIP_NEAR_INTERVAL 32          // BRRIP fills one block in this many as SRRIP would
+
+extern const char *repl_name(repl_policy_t policy);
+extern int repl_parse(const char *name, repl_policy_t *policy);
+
+// Replacement policies are template parameters of the cache access path, so each policy is compiled
+// into its own copy of it. A policy keeps one uint64_t of state per way, handed over one set at a time,
+// plus a clock shared by the whole cache. Free ways are always filled first, victim is only asked
+// for a full set.
+
+struct repl_lru {
+    static inline void touch(uint64_t *state, uint64_t ways, uint64_t way, uint64_t *clock) {
+        state[way] = ++*clock;
+    }
+    static inline void fill(uint64_t *state, uint64_t ways, uint64_t way, uint64_t level, uint64_t *clock) {
+        touch(state, ways, way, clock);
+    }
+    static inline uint64_t victim(uint64_t *state, uint64_t ways, uint64_t *clock) {
+        uint64_t victim = 0;
+        for (uint64_t way = 1; way < ways; way++) {
+            if (state[way] < state[victim]) {
+                victim = way;
+            }
+        }
+        return victim;
+    }
+};
+
+// Binary tree over the ways, node n has children 2n+1 and 2n+2 and points towards the half to
+// replace next. The ways - 1 nodes of a set are kept in its first ways - 1 state words.
+struct repl_plru {
+    static inline void touch(uint64_t *state, uint64_t ways, uint64_t way, uint64_t *clock) {
+        uint64_t node = 0;
+        for (uint64_t half = ways >> 1; half; half >>= 1) {
+            uint64_t right = (way & half) != 0;
+            state[node] = !right;
+            node = 2 * node + 1 + right;
+        }
+    }
+    static inline void fill(uint64_t *state, uint64_t ways, uint64_t way, uint64_t level, uint64_t *clock) {
+        touch(state, ways, way, clock);
+    }
+    static inline uint64_t victim(uint64_t *state, uint64_t ways, uint64_t *clock) {
+        uint64_t node = 0, way = 0;
+        for (uint64_t half = ways >> 1; half; half >>= 1) {
+            uint64_t right = state[node];
+            way |= right ? half : 0;
+            node = 2 * node + 1 + right;
+        }
+        return way;
+    }
+};
+
+// The state of a way is its re-reference prediction value, RRIP_MAX meaning distant
+struct repl_srrip {
+    static inline void touch(uint64_t *state, uint64_t ways, uint64_t way, uint64_t *clock) {
+        state[way] = 0;
+    }
+    static inline void fill(uint64_t *state, uint64_t ways, uint64_t way, uint64_t level, uint64_t *clock) {
+        state[way] = RRIP_MAX - 1;
+    }
+    // The first way predicted distant, after ageing the set until one is
+    static inline uint64_t victim(uint64_t *state, uint64_t ways, uint64_t *clock) {
+        uint64_t oldest = 0;
+        for (uint64_t way = 0; way < ways; way++) {
+            oldest = state[way] > oldest ? state[way] : oldest;
+        }
+        uint64_t age = RRIP_MAX - oldest;
+        uint64_t victim = ways;
+        for (uint64_t way = 0; way < ways; way++) {
+            state[way] += age;
+            if (state[way] == RRIP_MAX && victim == ways) {
+                victim = way;
+            }
+        }
+        return victim;
+    }
+};
+
+struct repl_brrip : repl_srrip {
+    static inline void fill(uint64_t *state, uint64_t ways, uint64_t way, uint64_t level, uint64_t *clock) {
+        state[way] = ++*clock % BRRIP_NEAR_INTERVAL == 0 ? RRIP_MAX - 1 : RRIP_MAX;
+    }
+};
+
+// Upper tree levels cover more data and are reused more, each level above the leaves is predicted
+// one step nearer on fill
+struct repl_level : repl_srrip {
+    static inline void fill(uint64_t *state, uint64_t ways, uint64_t way, uint64_t level, uint64_t *clock) {
+        state[way] = level < RRIP_MAX - 1 ? RRIP_MAX - 1 - level : 0;
+    }
+};
+
+#endif /* REPLACE_HPP */
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include "sample.hpp"
+
+/**
+ * @brief Read the windows of a SimPoint plan, one "index weight" pair per line
+ *
+ * @return 0 on success, -1 on error
+ */
+int sample_parse_points(const char *path, std::vector<sample_point_t> *points) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    char line[256];
+    uint64_t line_num = 0;
+    points->clear();
+    while (fgets(line, sizeof line, file)) {
+        line_num++;
+        sample_point_t point;
+        char extra;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%" SCNu64 " %lf %c", &point.index, &point.weight, &extra) != 2 || point.weight <= 0) {
+            fprintf(stderr, "%s:%" PRIu64 ": expected a window index and a positive weight\n", path, line_num);
+            fclose(file);
+            return -1;
+        }
+        points->push_back(point);
+    }
+    fclose(file);
+    std::sort(points->begin(), points->end(),
+              [](const sample_point_t &a, const sample_point_t &b) { return a.index < b.index; });
+    for (size_t i = 1; i < points->size(); i++) {
+        if ((*points)[i].index == (*points)[i - 1].index) {
+            fprintf(stderr, "%s: window %" PRIu64 " is listed twice\n", path, (*points)[i].index);
+            return -1;
+        }
+    }
+    if (points->empty()) {
+        fprintf(stderr, "%s: no windows\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void sample_counters(const sim_t *sim, uint64_t node_id, double *v) {
+    const sim_stats_t *stats = &sim->stats[node_id];
+    v[SAMPLE_ACCESSES] = stats->reads + stats->writes;
+    v[SAMPLE_CACHE_ACCESSES] = stats->accesses_l1;
+    v[SAMPLE_HITS] = stats->hits_l1;
+    v[SAMPLE_LEVELS] = stats->total_levels;
+    v[SAMPLE_DRAM_ACCESSES] = stats->num_dram_accesses;
+    v[SAMPLE_WRITEBACKS] = stats->writebacks_l1;
+    v[SAMPLE_INVAL_MSGS] = stats->num_inval_msgs;
+    v[SAMPLE_BLOCK_TRANSFERS] = stats->num_block_transfer;
+    v[SAMPLE_CYCLES] = sim->hist[node_id].cycles.sum;
+}
+
+static void sample_add(sample_sums_t *sums, const double *d, double w) {
+    sums->w += w;
+    for (int a = 0; a < SAMPLE_COUNTERS; a++) {
+        sums->x[a] += w * d[a];
+        for (int b = 0; b < SAMPLE_COUNTERS; b++) {
+            sums->xx[a][b] += w * d[a] * d[b];
+        }
+    }
+}
+
+/**
+ * @brief Simulate rounds of one trace entry per node, in full or by functional warming
+ *
+ * @param done Set once a trace ended, as in the main loop of the simulator
+ * @return Rounds simulated, fewer than asked if a trace ended
+ */
+static uint64_t sample_run(sim_t *sim, trace_t **trace, uint64_t rounds, bool detailed, bool *done) {
+    uint64_t address;
+    int rw;
+    for (uint64_t r = 0; r < rounds; r++) {
+        for (uint64_t i = 0; i < sim->num_nodes; i++) {
+            if (trace_read(trace[i], &address, &rw)) {
+                if (detailed) {
+                    sim_access(sim, i, (bool)rw, address);
+                } else {
+                    sim_warm(sim, i, (bool)rw, address);
+                }
+            }
+        }
+        for (uint64_t i = 0; i < sim->num_nodes; i++) {
+            if (trace_eof(trace[i])) {
+                *done = true;
+            }
+        }
+        if (*done) {
+            return r + 1;
+        }
+    }
+    return rounds;
+}
+
+// Fast forward over rounds without simulating them
+static uint64_t sample_skip(const sim_t *sim, trace_t **trace, uint64_t rounds, bool *done) {
+    uint64_t skipped = rounds;
+    for (uint64_t i = 0; i < sim->num_nodes; i++) {
+        skipped = std::min(skipped, trace_skip(trace[i], rounds));
+    }
+    for (uint64_t i = 0; i < sim->num_nodes; i++) {
+        if (trace_eof(trace[i])) {
+            *done = true;
+        }
+    }
+    *done |= skipped < rounds;
+    return skipped;
+}
+
+/**
+ * @brief Sampled simulation: detailed windows are simulated with sim_access, the entries before each
+ * window with functional warming, the rest are skipped
+ *
+ * The statistics of sim only cover the detailed windows. Each completed window adds the change of
+ * its counters to result, a window cut short by the end of the traces is left out.
+ *
+ * @return 0 on success
+ */
+int sim_sample(sim_t *sim, trace_t **trace, const sample_plan_t *plan, sample_result_t *result) {
+    uint64_t num_nodes = sim->num_nodes;
+    result->windows = 0;
+    result->detailed = 0;
+    result->warmed = 0;
+    result->sums.assign(num_nodes + 1, sample_sums_t());
+    std::vector<double> before(num_nodes * SAMPLE_COUNTERS);
+    uint64_t pos = 0;
+    bool done = false;
+    for (uint64_t k = 0; !done; k++) {
+        uint64_t start;
+        double weight = 1;
+        if (plan->period) {
+            start = k * plan->period + plan->period - plan->length;
+        } else if (k < plan->points.size()) {
+            start = plan->points[k].index * plan->length;
+            weight = plan->points[k].weight;
+        } else {
+            break;
+        }
+        uint64_t gap = start - pos;
+        uint64_t warm = std::min(gap, plan->warm);
+        pos += sample_skip(sim, trace, gap - warm, &done);
+        if (!done) {
+            uint64_t r = sample_run(sim, trace, warm, false, &done);
+            pos += r;
+            result->warmed += r;
+        }
+        if (done) {
+            break;
+        }
+        for (uint64_t i = 0; i < num_nodes; i++) {
+            sample_counters(sim, i, &before[i * SAMPLE_COUNTERS]);
+        }
+        uint64_t r = sample_run(sim, trace, plan->length, true, &done);
+        pos += r;
+        result->detailed += r;
+        if (r < plan->length) {
+            break;
+        }
+        double total[SAMPLE_COUNTERS] = {0};
+        for (uint64_t i = 0; i < num_nodes; i++) {
+            double d[SAMPLE_COUNTERS];
+            sample_counters(sim, i, d);
+            for (int a = 0; a < SAMPLE_COUNTERS; a++) {
+                d[a] -= before[i * SAMPLE_COUNTERS + a];
+                total[a] += d[a];
+            }
+            sample_add(&result->sums[i], d, weight);
+        }
+        sample_add(&result->sums[num_nodes], total, weight);
+        result->windows++;
+    }
+    if (!done) {
+        pos += sample_skip(sim, trace, UINT64_MAX, &done);
+    }
+    result->entries = pos;
+    return 0;
+}
+
+/**
+ * @brief Ratio estimate of y / x over the windows and the half width of its confidence interval
+ *
+ * Windows of a periodic plan are a systematic sample of the run, treated as a random one. SimPoint
+ * windows are chosen as representatives, not at random, so they get no interval (NAN).
+ */
+static double sample_ratio(const sample_sums_t *sums, uint64_t windows, bool random, int y, int x,
+                           double *half) {
+    *half = NAN;
+    if (sums->x[x] == 0) {
+        return NAN;
+    }
+    double r = sums->x[y] / sums->x[x];
+    if (random && windows > 1) {
+        double resid = sums->xx[y][y] - 2 * r * sums->xx[x][y] + r * r * sums->xx[x][x];
+        double mean_x = sums->x[x] / windows;
+        *half = SAMPLE_Z * sqrt(std::max(resid, 0.0) / (windows * (windows - 1.0))) / mean_x;
+    }
+    return r;
+}
+
+static void print_estimate(const char *name, double est, double half, double total_scale) {
+    printf("%-28s %14.4f", name, est);
+    if (std::isnan(half)) {
+        printf(" %14s %9s", "n/a", "n/a");
+    } else {
+        printf(" %14.4f %8.2f%%", half, est ? 100 * half / est : 0);
+    }
+    if (total_scale) {
+        printf(" %18.0f", est * total_scale);
+        if (!std::isnan(half)) {
+            printf(" +/- %.0f", half * total_scale);
+        }
+    }
+    printf("\n");
+}
+
+void sample_print(const sim_t *sim, const sample_plan_t *plan, const sample_result_t *result) {
+    static const struct {
+        const char *name;
+        int y, x;
+        bool total;                 // Per access, extrapolated to a total over the run
+    } rows[] = {
+        {"Cache accesses per access", SAMPLE_CACHE_ACCESSES, SAMPLE_ACCESSES, true},
+        {"Hit ratio", SAMPLE_HITS, SAMPLE_CACHE_ACCESSES, false},
+        {"Average level", SAMPLE_LEVELS, SAMPLE_ACCESSES, false},
+        {"DRAM accesses per access", SAMPLE_DRAM_ACCESSES, SAMPLE_ACCESSES, true},
+        {"Writebacks per access", SAMPLE_WRITEBACKS, SAMPLE_ACCESSES, true},
+        {"Inval msgs per access", SAMPLE_INVAL_MSGS, SAMPLE_ACCESSES, true},
+        {"Block transfers per access", SAMPLE_BLOCK_TRANSFERS, SAMPLE_ACCESSES, true},
+        {"Cycles per access", SAMPLE_CYCLES, SAMPLE_ACCESSES, true},
+    };
+    uint64_t num_rows = sizeof rows / sizeof rows[0] - (sim->config.timing ? 0 : 1);
+    double entries = result->entries ? result->entries : 1;
+    printf("\nSampled simulation: %" PRIu64 " windows of %" PRIu64 " accesses per node, %" PRIu64
+           " accesses per node in total\n", result->windows, plan->length, result->entries);
+    printf("Simulated in full: %.2f%%, warmed: %.2f%%, skipped: %.2f%%\n", 100 * result->detailed / entries,
+           100 * result->warmed / entries, 100 * (result->entries - result->detailed - result->warmed) / entries);
+    // Warming walks the tree like a full access, so every simulated access costs about the same
+    double simulated = result->detailed + result->warmed;
+    printf("Speedup over a full run: at most %.1fx, with %.2f%% of the accesses warmed",
+           entries / std::max(simulated, 1.0), 100 * result->warmed / entries);
+    if (plan->warm == SAMPLE_WARM_ALL) {
+        printf(" (whole gaps)\n");
+    } else {
+        printf(" (%" PRIu64 " before each window)\n", plan->warm);
+    }
+    if (result->windows == 0) {
+        printf("No detailed window completed, the traces end before the first one\n");
+        return;
+    }
+    for (uint64_t i = 0; i <= sim->num_nodes; i++) {
+        if (i == sim->num_nodes) {
+            printf("\nAll nodes\n");
+        } else {
+            printf("\nNode %" PRIu64 "\n", i);
+        }
+        uint64_t nodes = i == sim->num_nodes ? sim->num_nodes : 1;
+        printf("%-28s %14s %14s %9s %18s\n", "Estimate", "Value", "95% CI +/-", "Relative", "Extrapolated total");
+        for (uint64_t j = 0; j < num_rows; j++) {
+            double half;
+            double est = sample_ratio(&result->sums[i], result->windows, plan->period != 0, rows[j].y, rows[j].x,
+                                      &half);
+            print_estimate(rows[j].name, est, half, rows[j].total ? (double)result->entries * nodes : 0);
+        }
+    }
+}
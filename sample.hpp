@@ -0,0 +1,62 @@
+#ifndef SAMPLE_HPP
+#define SAMPLE_HPP
+
+#include <vector>
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+#define SAMPLE_LENGTH 10000             // Default accesses per node of a detailed window
+#define SAMPLE_WARM_WINDOWS 4           // Default accesses per node warmed before a window, in windows
+#define SAMPLE_WARM_ALL UINT64_MAX      // Warm the caches over the whole gap between windows
+#define SAMPLE_Z 1.96                   // Half width of the confidence intervals in standard errors (95%)
+
+// Counters of one node taken from every detailed window, the estimates are ratios of two of them
+typedef enum {
+    SAMPLE_ACCESSES,
+    SAMPLE_CACHE_ACCESSES,
+    SAMPLE_HITS,
+    SAMPLE_LEVELS,
+    SAMPLE_DRAM_ACCESSES,
+    SAMPLE_WRITEBACKS,
+    SAMPLE_INVAL_MSGS,
+    SAMPLE_BLOCK_TRANSFERS,
+    SAMPLE_CYCLES,
+    SAMPLE_COUNTERS,
+} sample_counter_t;
+
+// Detailed window of a SimPoint plan
+typedef struct sample_point {
+    uint64_t index;                 // Window number, it starts after index windows of accesses
+    double weight;                  // Fraction of the run the window stands for
+} sample_point_t;
+
+// Which accesses of each node are simulated in full, warmed or skipped. Positions count trace entries
+// of each node, all nodes advance together.
+typedef struct sample_plan {
+    uint64_t period;                // Entries between the starts of two windows, 0 to use points
+    uint64_t length;                // Entries of a detailed window
+    uint64_t warm;                  // Entries warmed before a window, SAMPLE_WARM_ALL for the whole gap
+    std::vector<sample_point_t> points; // SimPoint windows in increasing order
+} sample_plan_t;
+
+// Weighted sums over the windows of one counter pair x (denominator) and y (numerator) are kept as
+// sums of x, y, x^2, y^2 and xy for each node, enough for a ratio estimate and its variance
+typedef struct sample_sums {
+    double w;
+    double x[SAMPLE_COUNTERS];
+    double xx[SAMPLE_COUNTERS][SAMPLE_COUNTERS];
+} sample_sums_t;
+
+typedef struct sample_result {
+    uint64_t windows;               // Detailed windows completed
+    uint64_t entries;               // Entries of each node in the whole run
+    uint64_t detailed;              // Entries of each node simulated in full
+    uint64_t warmed;                // Entries of each node simulated by functional warming
+    std::vector<sample_sums_t> sums; // One per node, then all nodes together
+} sample_result_t;
+
+extern int sample_parse_points(const char *path, std::vector<sample_point_t> *points);
+extern int sim_sample(sim_t *sim, trace_t **trace, const sample_plan_t *plan, sample_result_t *result);
+extern void sample_print(const sim_t *sim, const sample_plan_t *plan, const sample_result_t *result);
+
+#endif /* SAMPLE_HPP */
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "shard.hpp"
+
+// Set-sharded engine: the sets of every cache are split over worker threads, each one running the tree walk
+// levels that fall into its sets. The coherence actions of an access only touch the same set of the other
+// nodes, and a directory set only holds blocks of the cache sets owned with it, so every block and its
+// sharers are owned by one shard. Each shard runs the levels of its sets in the order of the serial
+// simulation, so every set sees the same sequence of accesses and the statistics match sim_access exactly.
+// The only dependency between shards is that a read only goes on to the next level after a miss.
+
+#define SHARD_BATCH 65536               // Accesses decoded and handed to the shards at a time
+#define SHARD_WINDOW 1024               // Levels a shard looks ahead of its oldest pending one
+#define SHARD_STOP UINT32_MAX           // The walk of a read hit, its remaining levels are not accessed
+
+typedef struct shard_access {
+    uint64_t pfn;                   // Data pfn, masked
+    uint32_t node_id;
+    bool rw;
+} shard_access_t;
+
+// One level of the walk of one access, run by the shard owning its set
+typedef struct shard_op {
+    uint64_t pfn;                   // Metadata block of the level
+    uint32_t access;                // Index in the batch
+    uint32_t level;
+} shard_op_t;
+
+typedef struct shard_result {
+    uint32_t dram_accesses;         // Of the accessing node, caused by this level
+    bool done;
+    bool hit;
+} shard_result_t;
+
+typedef struct shard_batch {
+    std::vector<shard_access_t> accesses;
+    std::vector<std::vector<shard_op_t>> ops;   // Of each shard, in serial order
+    std::atomic<uint32_t> *next;                // Next level of the walk of each read, or SHARD_STOP
+    std::vector<shard_result_t> results;        // levels per access
+    uint64_t levels;                            // Cached levels of a walk
+    bool last;                                  // A trace ended in this batch
+} shard_batch_t;
+
+typedef struct shard {
+    sim_t sim;                      // View of the shared caches with the shard's own counters
+    std::vector<uint64_t> blocked;  // Scan in which each set got a level that must wait
+    uint64_t scan;
+    std::vector<uint32_t> pending;  // Levels not run yet, in serial order
+} shard_t;
+
+typedef struct shard_engine {
+    std::mutex lock;
+    std::condition_variable cv;
+    shard_batch_t batch[2];
+    uint64_t published;             // Batches handed to the shards
+    std::vector<uint64_t> progress; // Batches each shard has finished
+    std::vector<shard_t> shards;
+    bool dir_units;                 // Sets are owned by directory set, the directory has fewer sets than a cache
+    uint64_t group;                 // Consecutive sets owned by the same shard, a cache line of tags
+} shard_engine_t;
+
+/**
+ * @brief Configurations the sharded engine cannot run
+ *
+ * @return Why, or NULL if it can
+ */
+const char *shard_unsupported(const sim_config_t *config) {
+    if (!config->eager) {
+        return "lazy updates propagate evictions into the sets of other levels";
+    }
+    if (config->timing) {
+        return "the timing model orders all accesses in time";
+    }
+    if (config->repl == REPL_BRRIP) {
+        return "BRRIP fills depend on a clock shared by all sets";
+    }
+    return NULL;
+}
+
+// Cache set of a block, or its directory set if several cache sets share one. Levels of one unit run in order.
+static inline uint64_t shard_unit(const shard_engine_t *engine, const sim_t *sim, uint64_t pfn) {
+    if (engine->dir_units) {
+        return dir_set_index(&sim->dir, pfn);
+    }
+    return pfn & ((1ULL << sim->cache[0].idx) - 1);
+}
+
+static inline uint64_t shard_of(const shard_engine_t *engine, const sim_t *sim, uint64_t pfn) {
+    return shard_unit(engine, sim, pfn) / engine->group % engine->shards.size();
+}
+
+/**
+ * @brief Decode the next batch of rounds and split the levels of their walks over the shards
+ */
+static void shard_decode(shard_engine_t *engine, const sim_t *sim, trace_t **trace, shard_batch_t *batch) {
+    const tree_geometry_t *tree = &sim->tree;
+    uint64_t levels = batch->levels;
+    batch->accesses.clear();
+    for (auto &ops : batch->ops) {
+        ops.clear();
+    }
+    bool any_trace_done = false;
+    while (!any_trace_done && batch->accesses.size() + sim->num_nodes <= SHARD_BATCH) {
+        for (uint64_t i = 0; i < sim->num_nodes; i++) {
+            uint64_t rec = trace_read_rec(trace[i]);
+            if (rec == TRACE_REC_SKIP) {
+                continue;
+            }
+            uint64_t pfn = ((rec & ~TRACE_REC_RW) >> tree->block_size) & tree->pfn_mask;
+            uint32_t access = batch->accesses.size();
+            batch->accesses.push_back({pfn, (uint32_t)i, (rec & TRACE_REC_RW) != 0});
+            for (uint64_t level = 0; level < levels; level++) {
+                uint64_t metadata_pfn = tree_metadata_pfn<0>(tree, level, pfn);
+                batch->ops[shard_of(engine, sim, metadata_pfn)].push_back({metadata_pfn, access, (uint32_t)level});
+            }
+        }
+        for (uint64_t i = 0; i < sim->num_nodes; i++) {
+            if (trace_eof(trace[i])) {
+                any_trace_done = true;
+            }
+        }
+    }
+    batch->last = any_trace_done;
+    for (size_t a = 0; a < batch->accesses.size(); a++) {
+        batch->next[a].store(0, std::memory_order_relaxed);
+    }
+    std::fill_n(batch->results.begin(), batch->accesses.size() * levels, shard_result_t());
+}
+
+static void shard_run_op(shard_t *shard, shard_batch_t *batch, const shard_op_t *op) {
+    const shard_access_t *access = &batch->accesses[op->access];
+    sim_t *sim = &shard->sim;
+    uint64_t dram_accesses = sim->stats[access->node_id].num_dram_accesses;
+    bool hit = sim->walk_level(sim, access->node_id, op->pfn, access->pfn, op->level, access->rw);
+    shard_result_t *result = &batch->results[op->access * batch->levels + op->level];
+    result->dram_accesses = sim->stats[access->node_id].num_dram_accesses - dram_accesses;
+    result->done = true;
+    result->hit = hit;
+    if (access->rw == READ) {
+        batch->next[op->access].store(hit ? SHARD_STOP : op->level + 1, std::memory_order_release);
+    }
+}
+
+/**
+ * @brief Run the levels of a batch that fall into the shard's sets
+ *
+ * Levels of different sets do not depend on each other, so the shard runs any level in its window whose
+ * set has no older level waiting. Cache sets sharing a directory set count as one. A level of a read waits until the level below missed, and is dropped
+ * once a level below hit. Eager writes access every level.
+ */
+static void shard_run(const shard_engine_t *engine, shard_t *shard, shard_batch_t *batch,
+                      const std::vector<shard_op_t> &ops) {
+    std::vector<uint32_t> &pending = shard->pending;
+    size_t next_op = 0;
+    pending.clear();
+    while (next_op < ops.size() || !pending.empty()) {
+        while (pending.size() < SHARD_WINDOW && next_op < ops.size()) {
+            pending.push_back(next_op++);
+        }
+        uint64_t scan = ++shard->scan;
+        bool progress = false;
+        size_t kept = 0;
+        for (size_t k = 0; k < pending.size(); k++) {
+            const shard_op_t *op = &ops[pending[k]];
+            uint64_t set = shard_unit(engine, &shard->sim, op->pfn);
+            if (shard->blocked[set] != scan) {
+                bool run = batch->accesses[op->access].rw == WRITE;
+                if (!run) {
+                    uint32_t next = batch->next[op->access].load(std::memory_order_acquire);
+                    if (next == SHARD_STOP) {
+                        progress = true;
+                        continue;
+                    }
+                    run = next == op->level;
+                }
+                if (run) {
+                    shard_run_op(shard, batch, op);
+                    progress = true;
+                    continue;
+                }
+                shard->blocked[set] = scan;
+            }
+            pending[kept++] = pending[k];
+        }
+        pending.resize(kept);
+        if (!progress) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+static void shard_worker(shard_engine_t *engine, unsigned id) {
+    for (uint64_t n = 0;; n++) {
+        {
+            std::unique_lock<std::mutex> guard(engine->lock);
+            engine->cv.wait(guard, [&] { return engine->published > n; });
+        }
+        shard_batch_t *batch = &engine->batch[n & 1];
+        shard_run(engine, &engine->shards[id], batch, batch->ops[id]);
+        std::lock_guard<std::mutex> guard(engine->lock);
+        engine->progress[id] = n + 1;
+        engine->cv.notify_all();
+        if (batch->last) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Count the per-access statistics of a finished batch, as sim_access does after the walk
+ */
+static void shard_account(sim_t *sim, const shard_batch_t *batch) {
+    uint64_t pinned = sim->tree.pin_level;
+    uint64_t root = sim->tree.total_levels - 1;
+    for (size_t a = 0; a < batch->accesses.size(); a++) {
+        const shard_access_t *access = &batch->accesses[a];
+        const shard_result_t *result = &batch->results[a * batch->levels];
+        sim_stats_t *stats = &sim->stats[access->node_id];
+        uint64_t level_hit = pinned;
+        uint64_t cache_accesses = 0, dram_accesses = 0;
+        for (uint64_t level = 0; level < pinned && result[level].done; level++) {
+            cache_accesses++;
+            dram_accesses += result[level].dram_accesses;
+            if (access->rw == READ && result[level].hit) {
+                level_hit = level;
+                break;
+            }
+        }
+        if (access->rw == READ) {
+            stats->reads++;
+        } else {
+            stats->writes++;
+        }
+        stats->total_levels += level_hit;
+        stats->verify_depth[level_hit]++;
+        if (level_hit == pinned && pinned < root) {
+            stats->num_pinned_accesses++;
+        }
+        sim_hist_t *hist = &sim->hist[access->node_id];
+        hist_record(&hist->levels, level_hit + 1);
+        hist_record(&hist->cache_accesses, cache_accesses);
+        hist_record(&hist->dram_accesses, dram_accesses);
+    }
+}
+
+// Statistics of sim so far, the shards' counters included
+static void shard_totals(const shard_engine_t *engine, const sim_t *sim, std::vector<sim_stats_t> &totals) {
+    totals = sim->stats;
+    for (const auto &shard : engine->shards) {
+        for (uint64_t i = 0; i < sim->num_nodes; i++) {
+            sim_stats_add(&totals[i], &shard.sim.stats[i]);
+        }
+    }
+}
+
+static bool blocks_equal(const cache_entry_t *a, const cache_entry_t *b) {
+    return a->dirty == b->dirty && a->orig_pfn == b->orig_pfn && a->block_lvl == b->block_lvl &&
+           a->coh_state == b->coh_state && a->single_owner == b->single_owner && a->num_reads == b->num_reads &&
+           a->num_writes == b->num_writes && a->num_transfers == b->num_transfers;
+}
+
+// Compare the caches, directory and distributions of the sharded run against the serial one, once both are merged
+static bool shard_check_final(const sim_t *sim, const sim_t *ref) {
+    bool ok = true;
+    for (uint64_t i = 0; i < sim->num_nodes; i++) {
+        const cache_t *cache = &sim->cache[i];
+        uint64_t num_sets = 1ULL << cache->idx;
+        uint64_t num_blocks = num_sets << cache->s;
+        if (memcmp(cache->tags, ref->cache[i].tags, num_blocks * sizeof *cache->tags) != 0 ||
+            memcmp(cache->set_entries, ref->cache[i].set_entries, num_sets * sizeof *cache->set_entries) != 0) {
+            printf("Shard check: the tags of node %" PRIu64 " differ from the serial engine\n", i);
+            ok = false;
+            continue;
+        }
+        for (uint64_t b = 0; b < num_blocks; b++) {
+            if (!blocks_equal(&cache->blocks[b], &ref->cache[i].blocks[b])) {
+                printf("Shard check: block %" PRIu64 " of node %" PRIu64 " differs from the serial engine\n", b, i);
+                ok = false;
+                break;
+            }
+        }
+        if (memcmp(&sim->hist[i], &ref->hist[i], sizeof(sim_hist_t)) != 0) {
+            printf("Shard check: the histograms of node %" PRIu64 " differ from the serial engine\n", i);
+            ok = false;
+        }
+        if (cache->repl_clock != ref->cache[i].repl_clock) {
+            printf("Shard check: the replacement clock of node %" PRIu64 " differs from the serial engine\n", i);
+            ok = false;
+        }
+    }
+    if (sim->directory) {
+        // LRU stamps come from the clock of each shard, only their order within a set matches
+        for (uint64_t e = 0; e < (sim->dir.set_mask + 1) * DIR_WAYS; e++) {
+            const dir_entry_t *a = &sim->dir.entries[e], *b = &ref->dir.entries[e];
+            if (a->pfn != b->pfn || a->sharers != b->sharers || a->owner != b->owner || a->state != b->state) {
+                printf("Shard check: directory entry %" PRIu64 " differs from the serial engine\n", e);
+                ok = false;
+                break;
+            }
+        }
+        if (sim->dir.lru_clock != ref->dir.lru_clock) {
+            printf("Shard check: the directory clock differs from the serial engine\n");
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Simulate the traces with the sets of the caches split over num_shards threads
+ *
+ * The statistics left in sim are identical to those of the serial loop over sim_access. With check, the
+ * serial engine runs alongside on the same accesses and the statistics of every node are compared after
+ * each batch, the caches, directory and histograms at the end.
+ *
+ * @return 0 on success, -1 if the check found a difference
+ */
+int sim_sharded(sim_t *sim, trace_t **trace, unsigned num_shards, bool check) {
+    shard_engine_t engine;
+    uint64_t num_sets = 1ULL << sim->cache[0].idx;
+    engine.dir_units = sim->directory && sim->dir.set_mask < num_sets;
+    uint64_t num_units = engine.dir_units ? sim->dir.set_mask + 1 : num_sets;
+    // Sets sharing a cache line of tags stay together, directory sets are hashed so they need not
+    engine.group = engine.dir_units ? 1 : std::max<uint64_t>(1, 8 >> sim->cache[0].s);
+    num_shards = std::max<uint64_t>(1, std::min<uint64_t>(num_shards, num_units / engine.group));
+    engine.shards.resize(num_shards);
+    for (unsigned t = 0; t < num_shards; t++) {
+        shard_t *shard = &engine.shards[t];
+        uint64_t groups = num_units / engine.group;
+        uint64_t owned = (groups / num_shards + (t < groups % num_shards)) * engine.group;
+        sim_shard_setup(sim, &shard->sim, owned);
+        shard->blocked.assign(num_sets, 0);
+        shard->scan = 0;
+        shard->pending.reserve(SHARD_WINDOW);
+    }
+    for (int b = 0; b < 2; b++) {
+        shard_batch_t *batch = &engine.batch[b];
+        batch->levels = sim->tree.pin_level;
+        batch->ops.resize(num_shards);
+        batch->next = new std::atomic<uint32_t>[SHARD_BATCH];
+        batch->results.resize(SHARD_BATCH * std::max<uint64_t>(batch->levels, 1));
+        batch->accesses.reserve(SHARD_BATCH);
+    }
+    engine.published = 0;
+    engine.progress.assign(num_shards, 0);
+
+    sim_t ref;
+    if (check) {
+        sim_setup(&ref, &sim->config);
+    }
+    std::vector<sim_stats_t> totals;
+    bool ok = true;
+    uint64_t checked = 0;
+
+    shard_decode(&engine, sim, trace, &engine.batch[0]);
+    engine.published = 1;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < num_shards; t++) {
+        workers.push_back(std::thread(shard_worker, &engine, t));
+    }
+    // Decode batch n + 1 while the shards run batch n
+    for (uint64_t n = 0;; n++) {
+        shard_batch_t *batch = &engine.batch[n & 1];
+        if (!batch->last) {
+            shard_decode(&engine, sim, trace, &engine.batch[(n + 1) & 1]);
+        }
+        if (check) {
+            for (const auto &access : batch->accesses) {
+                sim_access(&ref, access.node_id, access.rw, access.pfn << sim->tree.block_size);
+            }
+        }
+        {
+            std::unique_lock<std::mutex> guard(engine.lock);
+            engine.cv.wait(guard, [&] {
+                return *std::min_element(engine.progress.begin(), engine.progress.end()) > n;
+            });
+        }
+        shard_account(sim, batch);
+        if (check && ok) {
+            shard_totals(&engine, sim, totals);
+            for (uint64_t i = 0; i < sim->num_nodes; i++) {
+                if (memcmp(&totals[i], &ref.stats[i], sizeof(sim_stats_t)) != 0) {
+                    printf("Shard check: the statistics of node %" PRIu64 " differ from the serial engine after "
+                           "batch %" PRIu64 "\n", i, n);
+                    ok = false;
+                    break;
+                }
+            }
+            checked++;
+        }
+        if (batch->last) {
+            break;
+        }
+        std::lock_guard<std::mutex> guard(engine.lock);
+        engine.published = n + 2;
+        engine.cv.notify_all();
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    for (auto &shard : engine.shards) {
+        sim_shard_merge(sim, &shard.sim);
+    }
+    for (int b = 0; b < 2; b++) {
+        delete[] engine.batch[b].next;
+    }
+    if (check) {
+        ok = ok && shard_check_final(sim, &ref);
+        if (ok) {
+            printf("Shard check: %u shards, %" PRIu64 " batches, identical to the serial engine\n", num_shards,
+                   checked);
+        }
+        sim_finish(&ref);
+    }
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,10 @@
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+extern const char *shard_unsupported(const sim_config_t *config);
+extern int sim_sharded(sim_t *sim, trace_t **trace, unsigned num_shards, bool check);
+
+#endif /* SHARD_HPP */
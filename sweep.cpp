@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "sweep.hpp"
+
+// Rounds (one entry per node) decoded into each chunk of the shared access stream
+static const uint64_t SWEEP_CHUNK_ROUNDS = 1 << 16;
+
+typedef struct sweep_point {
+    sim_config_t config;
+    sim_t sim;
+} sweep_point_t;
+
+typedef struct sweep_chunk {
+    uint64_t *recs;                 // num_nodes trace records per round, TRACE_REC_SKIP if no access
+    uint64_t rounds;
+} sweep_chunk_t;
+
+// The trace is decoded once into two alternating chunks shared by all workers
+typedef struct sweep_stream {
+    std::mutex lock;
+    std::condition_variable cv;
+    sweep_chunk_t chunk[2];
+    uint64_t published;             // Chunks handed to the workers
+    bool last;                      // No chunk will be published after the current one
+    std::vector<uint64_t> progress; // Chunks each worker has finished
+} sweep_stream_t;
+
+/**
+ * @brief Parse one sweep line, the same -c/-s/-l/-o/-h/-t/-d flags as the command line and -k for
+ * the pinned levels (--pin)
+ *
+ * @return true if the line is valid
+ */
+static bool parse_sweep_line(char *line, sim_config_t *config) {
+    char *save = NULL;
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+        if (tok[0] != '-' || tok[1] == '\0' || tok[2] != '\0') {
+            return false;
+        }
+        char *arg = NULL;
+        switch (tok[1]) {
+        case 'c':
+        case 'C':
+        case 's':
+        case 'S':
+        case 't':
+        case 'T':
+        case 'k':
+        case 'K':
+            arg = strtok_r(NULL, " \t\r\n", &save);
+            if (arg == NULL) {
+                return false;
+            }
+            if (tok[1] == 'c' || tok[1] == 'C') {
+                config->c = atoi(arg);
+            } else if (tok[1] == 's' || tok[1] == 'S') {
+                config->s = atoi(arg);
+            } else if (tok[1] == 'k' || tok[1] == 'K') {
+                config->pin_levels = atoi(arg);
+            } else {
+                config->write_thresh = atoi(arg);
+            }
+            break;
+        case 'l':
+        case 'L':
+            config->eager = false;
+            break;
+        case 'o':
+        case 'O':
+            config->single_owner = true;
+            break;
+        case 'h':
+        case 'H':
+            config->hybrid_coh = true;
+            break;
+        case 'd':
+        case 'D':
+            config->directory = true;
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+static int read_sweep_file(const char *path, const sim_config_t *base_config, std::vector<sim_config_t> &configs) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    char *line = NULL;
+    size_t len = 0;
+    int lineno = 0;
+    while (getline(&line, &len, file) >= 0) {
+        lineno++;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        if (strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+        sim_config_t config = *base_config;
+        if (!parse_sweep_line(line, &config)) {
+            fprintf(stderr, "%s:%d: invalid sweep configuration\n", path, lineno);
+            free(line);
+            fclose(file);
+            return -1;
+        }
+        if (config.c < config.s + METADATA_BLOCK_SIZE) {
+            fprintf(stderr, "%s:%d: cache smaller than one set\n", path, lineno);
+            free(line);
+            fclose(file);
+            return -1;
+        }
+        if (tree_check(&config)) {
+            fprintf(stderr, "%s:%d: %s\n", path, lineno, tree_check(&config));
+            free(line);
+            fclose(file);
+            return -1;
+        }
+        configs.push_back(config);
+    }
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+/**
+ * @brief Decode the next chunk of rounds, stopping after the round in which any trace ends
+ *
+ * @return true if a trace ended
+ */
+static bool decode_chunk(sweep_chunk_t *chunk, trace_t **trace, uint64_t num_nodes) {
+    bool any_trace_done = false;
+    chunk->rounds = 0;
+    while (!any_trace_done && chunk->rounds < SWEEP_CHUNK_ROUNDS) {
+        uint64_t *recs = chunk->recs + chunk->rounds * num_nodes;
+        for (uint64_t i = 0; i < num_nodes; i++) {
+            recs[i] = trace_read_rec(trace[i]);
+        }
+        for (uint64_t i = 0; i < num_nodes; i++) {
+            if (trace_eof(trace[i])) {
+                any_trace_done = true;
+            }
+        }
+        chunk->rounds++;
+    }
+    return any_trace_done;
+}
+
+static void run_chunk(sweep_point_t *point, const sweep_chunk_t *chunk) {
+    uint64_t num_nodes = point->sim.num_nodes;
+    const uint64_t *recs = chunk->recs;
+    for (uint64_t r = 0; r < chunk->rounds; r++, recs += num_nodes) {
+        for (uint64_t i = 0; i < num_nodes; i++) {
+            if (recs[i] != TRACE_REC_SKIP) {
+                sim_access(&point->sim, i, recs[i] & TRACE_REC_RW, recs[i] & ~TRACE_REC_RW);
+            }
+        }
+    }
+}
+
+static void sweep_worker(sweep_stream_t *stream, unsigned id, unsigned num_threads,
+                         std::vector<sweep_point_t *> *points) {
+    for (uint64_t n = 0;; n++) {
+        {
+            std::unique_lock<std::mutex> guard(stream->lock);
+            stream->cv.wait(guard, [&] { return stream->published > n || stream->last; });
+            if (stream->published == n) {
+                return;
+            }
+        }
+        const sweep_chunk_t *chunk = &stream->chunk[n & 1];
+        for (size_t p = id; p < points->size(); p += num_threads) {
+            run_chunk((*points)[p], chunk);
+        }
+        std::lock_guard<std::mutex> guard(stream->lock);
+        stream->progress[id] = n + 1;
+        stream->cv.notify_all();
+    }
+}
+
+static void sweep_totals(const sweep_point_t *point, sim_stats_t *total) {
+    memset(total, 0, sizeof *total);
+    for (uint64_t i = 0; i < point->sim.num_nodes; i++) {
+        const sim_stats_t *stats = &point->sim.stats[i];
+        total->reads += stats->reads;
+        total->writes += stats->writes;
+        total->accesses_l1 += stats->accesses_l1;
+        total->hits_l1 += stats->hits_l1;
+        total->misses_l1 += stats->misses_l1;
+        total->writebacks_l1 += stats->writebacks_l1;
+        total->total_levels += stats->total_levels;
+        total->num_dram_accesses += stats->num_dram_accesses;
+        total->num_pinned_accesses += stats->num_pinned_accesses;
+        total->num_inval_msgs += stats->num_inval_msgs;
+        total->num_block_transfer += stats->num_block_transfer;
+        total->num_wb_from_m2s += stats->num_wb_from_m2s;
+        total->num_dir_lookups += stats->num_dir_lookups;
+        total->num_dir_evictions += stats->num_dir_evictions;
+        total->num_dir_msgs += stats->num_dir_msgs;
+    }
+}
+
+static void print_sweep_row(const sweep_point_t *point) {
+    sim_stats_t total;
+    sweep_totals(point, &total);
+    const sim_config_t *config = &point->config;
+    double aat = ((L1_ARRAY_LOOKUP_TIME_CONST + point->sim.cache[0].tag_compare_time) * total.accesses_l1 +
+                  DRAM_ACCESS_PENALTY * total.misses_l1) / total.accesses_l1;
+    printf("%" PRIu64 ",%" PRIu64 ",%s,%d,%d,%" PRIu64 ",%s,", config->c, config->s, config->eager ? "eager" : "lazy",
+           config->single_owner, config->hybrid_coh, config->write_thresh, config->directory ? "directory" : "snoop");
+    printf("%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f,%" PRIu64 ",", total.reads, total.writes,
+           total.accesses_l1, total.hits_l1, total.misses_l1, total.hits_l1 * 1.0 / total.accesses_l1,
+           total.writebacks_l1);
+    printf("%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.2f,%.3f,", total.num_dram_accesses, total.num_inval_msgs,
+           total.num_block_transfer, total.num_wb_from_m2s, total.total_levels * 1.0 / (total.reads + total.writes),
+           aat);
+    printf("%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", total.num_dir_lookups,
+           total.num_dir_evictions, total.num_dir_msgs, config->pin_levels, total.num_pinned_accesses);
+}
+
+/**
+ * @brief Simulate every configuration over one decode of the traces
+ *
+ * The configurations are spread over num_threads workers which all consume the same decoded chunks of the
+ * access stream. The caller prints the statistics of each point and calls sim_finish.
+ */
+static void sweep_run(std::vector<sweep_point_t *> &points, const sim_config_t *base_config, trace_t **trace,
+                      unsigned num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    num_threads = std::max(1U, std::min<unsigned>(num_threads, points.size()));
+
+    sweep_stream_t stream;
+    for (int b = 0; b < 2; b++) {
+        stream.chunk[b].recs = new uint64_t[SWEEP_CHUNK_ROUNDS * base_config->num_nodes];
+        stream.chunk[b].rounds = 0;
+    }
+    stream.published = 0;
+    stream.last = false;
+    stream.progress.assign(num_threads, 0);
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < num_threads; t++) {
+        workers.push_back(std::thread(sweep_worker, &stream, t, num_threads, &points));
+    }
+    // Decode chunk n while the workers simulate chunk n - 1
+    for (uint64_t n = 0;; n++) {
+        if (n >= 2) {
+            std::unique_lock<std::mutex> guard(stream.lock);
+            stream.cv.wait(guard, [&] {
+                return *std::min_element(stream.progress.begin(), stream.progress.end()) >= n - 1;
+            });
+        }
+        bool done = decode_chunk(&stream.chunk[n & 1], trace, base_config->num_nodes);
+        std::lock_guard<std::mutex> guard(stream.lock);
+        stream.published = n + 1;
+        stream.last = done;
+        stream.cv.notify_all();
+        if (done) {
+            break;
+        }
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    for (int b = 0; b < 2; b++) {
+        delete[] stream.chunk[b].recs;
+    }
+}
+
+static std::vector<sweep_point_t *> sweep_points(const std::vector<sim_config_t> &configs) {
+    std::vector<sweep_point_t *> points;
+    for (size_t p = 0; p < configs.size(); p++) {
+        sweep_point_t *point = new sweep_point_t();
+        point->config = configs[p];
+        sim_setup(&point->sim, &point->config);
+        points.push_back(point);
+    }
+    return points;
+}
+
+/**
+ * @brief Simulate every configuration of a sweep file over one decode of the traces
+ *
+ * Each line of the sweep file holds the -c/-s/-l/-o/-h/-t/-d/-k flags of one configuration, applied on
+ * top of base_config. One CSV row is printed per configuration, summed over all nodes.
+ *
+ * @return 0 on success, -1 on error
+ */
+int sim_sweep(const char *sweep_path, const sim_config_t *base_config, trace_t **trace, unsigned num_threads) {
+    std::vector<sim_config_t> configs;
+    if (read_sweep_file(sweep_path, base_config, configs) < 0) {
+        return -1;
+    }
+    if (configs.empty()) {
+        fprintf(stderr, "%s: no configurations\n", sweep_path);
+        return -1;
+    }
+    std::vector<sweep_point_t *> points = sweep_points(configs);
+    sweep_run(points, base_config, trace, num_threads);
+
+    printf("c,s,update,single_owner,hybrid_coh,write_thresh,coherence,reads,writes,accesses,hits,misses,hit_ratio,"
+           "writebacks,dram_accesses,inval_msgs,block_transfers,wb_from_m2s,avg_level,aat,dir_lookups,dir_evictions,"
+           "dir_msgs,pinned_levels,pinned_accesses\n");
+    for (auto point : points) {
+        sim_finish(&point->sim);
+        print_sweep_row(point);
+        delete point;
+    }
+    return 0;
+}
+
+/**
+ * @brief Savings of pinning the top 0 to max_pin tree levels below the root, all simulated in one pass
+ *
+ * The AAT is the average time of a metadata access, served by the metadata cache or the pinned buffer,
+ * and it and the DRAM accesses are compared against no pinned levels. One CSV row is printed per number
+ * of pinned levels, summed over all nodes.
+ *
+ * @return 0 on success, -1 on error
+ */
+int sim_pin_report(const sim_config_t *base_config, trace_t **trace, unsigned num_threads, uint64_t max_pin) {
+    std::vector<sim_config_t> configs;
+    for (uint64_t k = 0; k <= max_pin; k++) {
+        configs.push_back(*base_config);
+        configs.back().pin_levels = k;
+    }
+    std::vector<sweep_point_t *> points = sweep_points(configs);
+    sweep_run(points, base_config, trace, num_threads);
+
+    printf("pinned_levels,pinned_blocks,pinned_bytes,accesses,misses,pinned_accesses,dram_accesses,aat,"
+           "aat_saving,dram_saving\n");
+    double base_aat = 0;
+    uint64_t base_dram = 0;
+    for (auto point : points) {
+        sim_stats_t total;
+        sweep_totals(point, &total);
+        double hit_time = L1_ARRAY_LOOKUP_TIME_CONST + point->sim.cache[0].tag_compare_time;
+        uint64_t lookups = total.accesses_l1 + total.num_pinned_accesses;
+        double aat = (hit_time * total.accesses_l1 + PINNED_ACCESS_TIME * total.num_pinned_accesses +
+                      DRAM_ACCESS_PENALTY * total.misses_l1) / lookups;
+        if (point->config.pin_levels == 0) {
+            base_aat = aat;
+            base_dram = total.num_dram_accesses;
+        }
+        uint64_t blocks = tree_pinned_blocks(&point->sim.tree);
+        printf("%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f,%.2f%%,%.2f%%\n",
+               point->config.pin_levels, blocks, blocks << point->sim.cache[0].b, total.accesses_l1, total.misses_l1,
+               total.num_pinned_accesses, total.num_dram_accesses, aat, 100 * (base_aat - aat) / base_aat,
+               100 * (base_dram - (double)total.num_dram_accesses) / base_dram);
+        sim_finish(&point->sim);
+        delete point;
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+extern int sim_sweep(const char *sweep_path, const sim_config_t *base_config, trace_t **trace, unsigned num_threads);
+extern int sim_pin_report(const sim_config_t *base_config, trace_t **trace, unsigned num_threads, uint64_t max_pin);
+
+#endif /* SWEEP_HPP */
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TAG_MATCH_X86 1
+#endif
+#include "tagmatch.hpp"
+
+#define TAG_BENCH_MAX_S 6               // Associativities benchmarked, 2^0 .. 2^TAG_BENCH_MAX_S ways
+#define TAG_BENCH_SETS 1024             // Sets of the benchmarked tag array
+#define TAG_BENCH_QUERIES (1 << 16)     // Distinct lookups, half of them hit
+#define TAG_BENCH_LOOKUPS (1 << 24)     // Lookups timed per kernel and associativity
+
+int64_t tag_match_scalar(const uint64_t *set, uint64_t ways, uint64_t tag) {
+    for (uint64_t way = 0; way < ways; way++) {
+        if (set[way] == tag) {
+            return way;
+        }
+    }
+    return -1;
+}
+
+#ifdef TAG_MATCH_X86
+// Compares of up to 64 ways are merged into one mask before branching, the way that matches is
+// unpredictable so one branch per group beats one per vector.
+
+// 4 ways per compare, ways must be a multiple of 4
+__attribute__((target("avx2")))
+static int64_t tag_match_avx2(const uint64_t *set, uint64_t ways, uint64_t tag) {
+    __m256i key = _mm256_set1_epi64x(tag);
+    for (uint64_t base = 0; base < ways; base += 64) {
+        uint64_t match = 0;
+        for (uint64_t way = 0; way < std::min<uint64_t>(ways - base, 64); way += 4) {
+            __m256i tags = _mm256_loadu_si256((const __m256i *)(set + base + way));
+            uint64_t eq = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(tags, key)));
+            match |= eq << way;
+        }
+        if (match) {
+            return base + __builtin_ctzll(match);
+        }
+    }
+    return -1;
+}
+
+// 8 ways per compare, ways must be a multiple of 8
+__attribute__((target("avx512f")))
+static int64_t tag_match_avx512(const uint64_t *set, uint64_t ways, uint64_t tag) {
+    __m512i key = _mm512_set1_epi64(tag);
+    for (uint64_t base = 0; base < ways; base += 64) {
+        uint64_t match = 0;
+        for (uint64_t way = 0; way < std::min<uint64_t>(ways - base, 64); way += 8) {
+            uint64_t eq = _mm512_cmpeq_epi64_mask(_mm512_loadu_si512(set + base + way), key);
+            match |= eq << way;
+        }
+        if (match) {
+            return base + __builtin_ctzll(match);
+        }
+    }
+    return -1;
+}
+#endif
+
+bool tag_match_supported(tag_match_kind_t kind) {
+    switch (kind) {
+    case TAG_MATCH_AUTO:
+    case TAG_MATCH_SCALAR:
+        return true;
+#ifdef TAG_MATCH_X86
+    case TAG_MATCH_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case TAG_MATCH_AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Kernel to use for sets of the given number of ways
+ *
+ * Auto picks the widest supported kernel. Sets narrower than a vector use the next narrower kernel,
+ * down to the scalar loop, so every kernel only handles whole vectors.
+ */
+tag_match_fn tag_match_kernel(tag_match_kind_t kind, uint64_t ways) {
+    if (kind == TAG_MATCH_AUTO) {
+        kind = tag_match_supported(TAG_MATCH_AVX512) ? TAG_MATCH_AVX512 :
+               tag_match_supported(TAG_MATCH_AVX2) ? TAG_MATCH_AVX2 : TAG_MATCH_SCALAR;
+    }
+    if (!tag_match_supported(kind)) {
+        return tag_match_scalar;
+    }
+#ifdef TAG_MATCH_X86
+    if (kind == TAG_MATCH_AVX512 && ways >= 8) {
+        return tag_match_avx512;
+    }
+    if (kind != TAG_MATCH_SCALAR && ways >= 4 && tag_match_supported(TAG_MATCH_AVX2)) {
+        return tag_match_avx2;
+    }
+#endif
+    return tag_match_scalar;
+}
+
+static const char *const tag_match_names[] = {"auto", "scalar", "avx2", "avx512"};
+
+const char *tag_match_name(tag_match_kind_t kind) {
+    return tag_match_names[kind];
+}
+
+/**
+ * @return 0 if name is a kernel, -1 otherwise
+ */
+int tag_match_parse(const char *name, tag_match_kind_t *kind) {
+    for (int k = TAG_MATCH_AUTO; k <= TAG_MATCH_AVX512; k++) {
+        if (strcmp(name, tag_match_names[k]) == 0) {
+            *kind = (tag_match_kind_t)k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static inline uint64_t bench_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * @brief Time every supported kernel against the scalar loop at each associativity
+ *
+ * Full sets of random tags are probed with a fixed mix of hits at random ways and misses. One CSV row
+ * is printed per associativity and kernel, kernels narrower than the set are skipped.
+ *
+ * @return 0 on success, -1 if a kernel disagreed with the scalar loop
+ */
+int tag_match_bench(void) {
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    printf("ways,kernel,ns_per_lookup,speedup\n");
+    for (uint64_t s = 0; s <= TAG_BENCH_MAX_S; s++) {
+        uint64_t ways = 1ULL << s;
+        std::vector<uint64_t> tags(TAG_BENCH_SETS * ways);
+        for (auto &tag : tags) {
+            tag = bench_rand(&seed) >> 1;       // Never INVALID_TAG
+        }
+        std::vector<uint64_t> query_set(TAG_BENCH_QUERIES), query_tag(TAG_BENCH_QUERIES);
+        for (uint64_t q = 0; q < TAG_BENCH_QUERIES; q++) {
+            query_set[q] = bench_rand(&seed) % TAG_BENCH_SETS;
+            bool hit = q & 1;
+            query_tag[q] = hit ? tags[query_set[q] * ways + bench_rand(&seed) % ways] : bench_rand(&seed) >> 1;
+        }
+        double scalar_ns = 0;
+        int64_t scalar_sum = 0;
+        std::vector<tag_match_fn> timed;
+        for (int k = TAG_MATCH_SCALAR; k <= TAG_MATCH_AVX512; k++) {
+            tag_match_kind_t kind = (tag_match_kind_t)k;
+            tag_match_fn match = tag_match_kernel(kind, ways);
+            if (!tag_match_supported(kind) || std::find(timed.begin(), timed.end(), match) != timed.end()) {
+                continue;
+            }
+            timed.push_back(match);
+            int64_t sum = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t n = 0; n < TAG_BENCH_LOOKUPS; n++) {
+                uint64_t q = n & (TAG_BENCH_QUERIES - 1);
+                sum += match(&tags[query_set[q] * ways], ways, query_tag[q]);
+            }
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                        TAG_BENCH_LOOKUPS;
+            if (kind == TAG_MATCH_SCALAR) {
+                scalar_ns = ns;
+                scalar_sum = sum;
+            } else if (sum != scalar_sum) {
+                fprintf(stderr, "%s tag match disagrees with scalar at %" PRIu64 " ways\n", tag_match_name(kind), ways);
+                return -1;
+            }
+            printf("%" PRIu64 ",%s,%.3f,%.2f\n", ways, tag_match_name(kind), ns, scalar_ns / ns);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef TAGMATCH_HPP
+#define TAGMATCH_HPP
+
+#include <stdint.h>
+
+// Tag compare kernels, auto picks the widest one the CPU supports
+typedef enum {
+    TAG_MATCH_AUTO,
+    TAG_MATCH_SCALAR,
+    TAG_MATCH_AVX2,
+    TAG_MATCH_AVX512,
+} tag_match_kind_t;
+
+/**
+ * @brief Compare tag against every way of one set
+ *
+ * @param set Tags of the set, INVALID_TAG for free ways
+ * @param ways Ways of the set, a power of two
+ * @return First way holding tag, or -1
+ */
+typedef int64_t (*tag_match_fn)(const uint64_t *set, uint64_t ways, uint64_t tag);
+
+extern int64_t tag_match_scalar(const uint64_t *set, uint64_t ways, uint64_t tag);
+extern bool tag_match_supported(tag_match_kind_t kind);
+extern tag_match_fn tag_match_kernel(tag_match_kind_t kind, uint64_t ways);
+extern const char *tag_match_name(tag_match_kind_t kind);
+extern int tag_match_parse(const char *name, tag_match_kind_t *kind);
+extern int tag_match_bench(void);
+
+#endif /* TAGMATCH_HPP */
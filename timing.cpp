@@ -0,0 +1,148 @@
+#include <algorithm>
+#include "cachesim.hpp"
+#include "timing.hpp"
+
+#define TIMING_PRUNE_INTERVAL 4096      // Accesses between drops of channel intervals no request can reach
+
+timing_t *timing_setup(const sim_config_t *config, uint64_t hit_latency) {
+    timing_t *timing = new timing_t();
+    timing->mshrs = config->mshrs;
+    timing->dram_latency = config->dram_latency;
+    timing->dram_xfer = ((1ULL << METADATA_BLOCK_SIZE) + config->dram_bw - 1) / config->dram_bw;
+    timing->coh_latency = config->coh_latency;
+    timing->hit_latency = hit_latency;
+    timing->node.resize(config->num_nodes);
+    for (auto &node : timing->node) {
+        node.mshr.assign(timing->mshrs, 0);
+    }
+    return timing;
+}
+
+void timing_free(timing_t *timing) {
+    delete timing;
+}
+
+void timing_snapshot(const sim_t *sim, uint64_t node_id, timing_snapshot_t *snap) {
+    const sim_stats_t *stats = &sim->stats[node_id];
+    snap->dram_reads = stats->num_dram_reads;
+    snap->block_transfers = stats->num_block_transfer;
+    snap->inval_msgs = stats->num_inval_msgs;
+    snap->dir_lookups = stats->num_dir_lookups;
+    snap->dram_writes = sim->timing->dram_writes;
+}
+
+/**
+ * @brief Reserve the DRAM channel for one block transfer
+ *
+ * Requests do not arrive in cycle order since nodes run ahead of each other, so the channel keeps its
+ * busy intervals and a transfer takes the first gap at or after its issue cycle.
+ *
+ * @return Cycle the transfer starts
+ */
+static uint64_t channel_reserve(timing_t *timing, timing_node_t *node, uint64_t t) {
+    std::map<uint64_t, uint64_t> &busy = timing->channel;
+    uint64_t issue = t;
+    auto it = busy.upper_bound(t);
+    if (it != busy.begin() && std::prev(it)->second > t) {
+        t = std::prev(it)->second;
+    }
+    while (it != busy.end() && it->first < t + timing->dram_xfer) {
+        t = std::max(t, it->second);
+        ++it;
+    }
+    uint64_t end = t + timing->dram_xfer;
+    // Merge with the intervals ending at t and starting at end
+    if (it != busy.end() && it->first == end) {
+        end = it->second;
+        it = busy.erase(it);
+    }
+    if (it != busy.begin() && std::prev(it)->second == t) {
+        std::prev(it)->second = end;
+    } else {
+        busy.emplace_hint(it, t, end);
+    }
+    node->dram_transfers++;
+    node->dram_queue_cycles += t - issue;
+    return t;
+}
+
+// Intervals ending before every node's clock can no longer delay a request
+static void channel_prune(timing_t *timing) {
+    uint64_t oldest = UINT64_MAX;
+    for (const auto &node : timing->node) {
+        oldest = std::min(oldest, node.now);
+    }
+    auto it = timing->channel.begin();
+    while (it != timing->channel.end() && it->second < oldest) {
+        it = timing->channel.erase(it);
+    }
+}
+
+/**
+ * @brief Fetch one block through an MSHR of the node
+ *
+ * @param dram From DRAM, otherwise from another node's cache
+ * @return Cycle the block arrives
+ */
+static uint64_t fetch(timing_t *timing, timing_node_t *node, uint64_t t, bool dram) {
+    auto mshr = std::min_element(node->mshr.begin(), node->mshr.end());
+    t = std::max(t, *mshr);
+    uint64_t done = dram ? channel_reserve(timing, node, t) + timing->dram_latency : t + 2 * timing->coh_latency;
+    *mshr = done;
+    return done;
+}
+
+void timing_begin(timing_t *timing, uint64_t node_id) {
+    timing_node_t *node = &timing->node[node_id];
+    node->done = node->now + timing->hit_latency;
+}
+
+/**
+ * @brief Time the events of the cache access that followed the last timing_snapshot into timing->before
+ *
+ * All levels of a walk are looked up at once when it is issued, so every access starts after one hit
+ * latency from the node's clock. A miss fetches its block from DRAM or over the interconnect after the
+ * directory lookup, invalidations take a message round trip and dirty writebacks only occupy the channel.
+ *
+ * @param critical Part of the verification, otherwise a lazy propagation done off the critical path
+ */
+void timing_cache_access(timing_t *timing, const sim_t *sim, uint64_t node_id, bool critical) {
+    timing_snapshot_t after;
+    timing_snapshot(sim, node_id, &after);
+    const timing_snapshot_t *before = &timing->before;
+    timing_node_t *node = &timing->node[node_id];
+    uint64_t t = node->now + timing->hit_latency;
+    uint64_t done = t;
+    if (after.dir_lookups != before->dir_lookups) {
+        t += timing->coh_latency;
+        done = t;
+    }
+    if (after.block_transfers != before->block_transfers) {
+        done = std::max(done, fetch(timing, node, t, false));
+    } else if (after.dram_reads != before->dram_reads) {
+        done = std::max(done, fetch(timing, node, t, true));
+    }
+    if (after.inval_msgs != before->inval_msgs) {
+        done = std::max(done, t + 2 * timing->coh_latency);
+    }
+    for (uint64_t w = before->dram_writes; w < after.dram_writes; w++) {
+        channel_reserve(timing, node, t);
+    }
+    if (critical) {
+        node->done = std::max(node->done, done);
+    }
+}
+
+/**
+ * @return Verification latency of the access
+ */
+uint64_t timing_end(timing_t *timing, uint64_t node_id) {
+    timing_node_t *node = &timing->node[node_id];
+    uint64_t latency = node->done - node->now;
+    node->now = node->done;
+    if (++timing->since_prune == TIMING_PRUNE_INTERVAL) {
+        channel_prune(timing);
+        timing->since_prune = 0;
+    }
+    return latency;
+}
@@ -0,0 +1,58 @@
+#ifndef TIMING_HPP
+#define TIMING_HPP
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+// Timing model defaults, in cycles unless noted
+#define TIMING_MSHRS 8                  // Outstanding fetches per node
+#define TIMING_DRAM_LATENCY 100         // From the start of a transfer to its data
+#define TIMING_DRAM_BW 8                // Bytes the DRAM channel moves per cycle
+#define TIMING_COH_LATENCY 20           // One way latency of a coherence message
+
+struct sim;
+
+// Counters of the functional model read before and after each cache access, their changes are the
+// events the access caused
+typedef struct timing_snapshot {
+    uint64_t dram_reads;            // Of the accessing node
+    uint64_t dram_writes;           // Of all nodes
+    uint64_t block_transfers;
+    uint64_t inval_msgs;
+    uint64_t dir_lookups;
+} timing_snapshot_t;
+
+typedef struct timing_node {
+    uint64_t now;                   // Cycle the node issues its next access at
+    std::vector<uint64_t> mshr;     // Cycle each MSHR is free from
+    uint64_t done;                  // Cycle the current verification completes
+    uint64_t dram_transfers;        // Reads and writebacks on the channel
+    uint64_t dram_queue_cycles;     // Cycles they waited for the channel
+} timing_node_t;
+
+// Event driven timing layered on the functional model. Accesses keep the order of the functional model,
+// each node issues its next access once its current verification completed. Levels missing in the cache
+// are fetched in parallel, each one holding an MSHR of its node, and every DRAM transfer reserves the
+// first free interval of the shared channel at or after the cycle it is issued.
+typedef struct timing {
+    uint64_t mshrs;
+    uint64_t dram_latency;
+    uint64_t dram_xfer;             // Channel cycles per metadata block
+    uint64_t coh_latency;
+    uint64_t hit_latency;           // Tag lookup of all levels of a walk, done in parallel
+    std::vector<timing_node_t> node;
+    std::map<uint64_t, uint64_t> channel;   // Busy intervals of the DRAM channel, start to end
+    uint64_t since_prune;
+    uint64_t dram_writes;           // Writebacks of all nodes so far, kept up to date by the functional model
+    timing_snapshot_t before;
+} timing_t;
+
+extern timing_t *timing_setup(const struct sim_config *config, uint64_t hit_latency);
+extern void timing_free(timing_t *timing);
+extern void timing_snapshot(const struct sim *sim, uint64_t node_id, timing_snapshot_t *snap);
+extern void timing_begin(timing_t *timing, uint64_t node_id);
+extern void timing_cache_access(timing_t *timing, const struct sim *sim, uint64_t node_id, bool critical);
+extern uint64_t timing_end(timing_t *timing, uint64_t node_id);
+
+#endif /* TIMING_HPP */
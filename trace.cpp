@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "trace.hpp"
+#include "workload.hpp"
+
+extern char **environ;
+
+// Records of a binary trace read as a stream instead of mapped
+static const size_t TRACE_STREAM_RECS = 1 << 16;
+
+typedef struct compressor {
+    const char *magic;
+    size_t magic_len;
+    const char *tool;               // Decompresses stdin to stdout with -dc
+} compressor_t;
+
+static const compressor_t compressors[] = {
+    {"\x1f\x8b", 2, "gzip"},
+    {"\x28\xb5\x2f\xfd", 4, "zstd"},
+    {"\xfd" "7zXZ\x00", 6, "xz"},
+};
+
+// Output of a decompressor process, with the first bytes read ahead to detect the trace format
+typedef struct decompressor {
+    int fd;
+    pid_t pid;                      // -1 once reaped
+    char peek[sizeof(trace_header_t)];
+    size_t peek_len;
+    size_t peek_pos;
+} decompressor_t;
+
+static bool is_binary_header(const trace_header_t *header) {
+    bool binary = memcmp(header->magic, TRACE_MAGIC, sizeof header->magic) == 0;
+    if (binary && header->version != TRACE_VERSION) {
+        fprintf(stderr, "Unsupported binary trace version %u\n", header->version);
+    }
+    return binary;
+}
+
+static bool is_binary_trace(FILE *file) {
+    trace_header_t header;
+    bool binary = fread(&header, sizeof header, 1, file) == 1 && is_binary_header(&header);
+    rewind(file);
+    return binary;
+}
+
+static const compressor_t *find_compressor(FILE *file) {
+    char magic[8];
+    size_t len = fread(magic, 1, sizeof magic, file);
+    rewind(file);
+    for (size_t i = 0; i < sizeof compressors / sizeof *compressors; i++) {
+        if (len >= compressors[i].magic_len && memcmp(magic, compressors[i].magic, compressors[i].magic_len) == 0) {
+            return &compressors[i];
+        }
+    }
+    return NULL;
+}
+
+static bool reap_decompressor(decompressor_t *dec) {
+    int status;
+    while (waitpid(dec->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    dec->pid = -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static ssize_t decompressor_read(void *cookie, char *buf, size_t size) {
+    decompressor_t *dec = (decompressor_t *)cookie;
+    if (dec->peek_pos < dec->peek_len) {
+        size_t n = std::min(size, dec->peek_len - dec->peek_pos);
+        memcpy(buf, dec->peek + dec->peek_pos, n);
+        dec->peek_pos += n;
+        return n;
+    }
+    ssize_t n;
+    while ((n = read(dec->fd, buf, size)) < 0 && errno == EINTR) {
+    }
+    if (n < 0) {
+        perror("read");
+        return -1;
+    }
+    if (n == 0 && dec->pid > 0 && !reap_decompressor(dec)) {
+        fprintf(stderr, "Decompressing the trace failed, it ends early\n");
+    }
+    return n;
+}
+
+static int decompressor_close(void *cookie) {
+    decompressor_t *dec = (decompressor_t *)cookie;
+    if (dec->pid > 0) {
+        // Stopped before the end of the trace
+        kill(dec->pid, SIGTERM);
+        reap_decompressor(dec);
+    }
+    close(dec->fd);
+    delete dec;
+    return 0;
+}
+
+/**
+ * @brief Open a compressed trace as the output of its decompressor, which runs in its own process so
+ * decompression overlaps the simulation and nothing is written to disk
+ *
+ * @return 0 on success, -1 on error
+ */
+static int open_compressed_trace(trace_t *trace, const char *path, const compressor_t *comp) {
+    int in = open(path, O_RDONLY);
+    if (in < 0) {
+        perror("open");
+        return -1;
+    }
+    int out[2];
+    if (pipe(out) < 0) {
+        perror("pipe");
+        close(in);
+        return -1;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, in);
+    posix_spawn_file_actions_addclose(&actions, out[0]);
+    posix_spawn_file_actions_addclose(&actions, out[1]);
+    char *argv[] = {(char *)comp->tool, (char *)"-dc", NULL};
+    pid_t pid;
+    int err = posix_spawnp(&pid, comp->tool, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in);
+    close(out[1]);
+    if (err != 0) {
+        fprintf(stderr, "Could not run %s: %s\n", comp->tool, strerror(err));
+        close(out[0]);
+        return -1;
+    }
+
+    decompressor_t *dec = new decompressor_t();
+    dec->fd = out[0];
+    dec->pid = pid;
+    dec->peek_len = 0;
+    dec->peek_pos = 0;
+    while (dec->peek_len < sizeof dec->peek) {
+        ssize_t n = read(dec->fd, dec->peek + dec->peek_len, sizeof dec->peek - dec->peek_len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        dec->peek_len += n;
+    }
+    trace->format = TRACE_TEXT;
+    if (dec->peek_len == sizeof(trace_header_t) && is_binary_header((const trace_header_t *)dec->peek)) {
+        // Skip the header, records are read through a buffer instead of a mapping
+        dec->peek_pos = dec->peek_len;
+        trace->format = TRACE_BINARY;
+        trace->buf = new uint64_t[TRACE_STREAM_RECS];
+        trace->cur = trace->end = trace->buf;
+    }
+    cookie_io_functions_t io = {decompressor_read, NULL, NULL, decompressor_close};
+    trace->file = fopencookie(dec, "r", io);
+    if (trace->file == NULL) {
+        perror("fopencookie");
+        decompressor_close(dec);
+        return -1;
+    }
+    return 0;
+}
+
+static int map_binary_trace(trace_t *trace, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (trace->map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise(trace->map, trace->map_size, MADV_SEQUENTIAL);
+    size_t num_recs = (trace->map_size - sizeof(trace_header_t)) / sizeof(uint64_t);
+    trace->cur = (const uint64_t *)((const char *)trace->map + sizeof(trace_header_t));
+    trace->end = trace->cur + num_recs;
+    return 0;
+}
+
+/**
+ * @brief Open a trace, binary traces are recognized by their header and mapped into memory.
+ * Traces compressed with gzip, zstd or xz are recognized by their magic bytes and decompressed
+ * as a stream.
+ *
+ * @param reversed Text trace lines are (rw, addr) instead of (addr, rw)
+ * @return The trace, or NULL if it could not be opened
+ */
+trace_t *trace_open(const char *path, bool reversed) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("fopen");
+        return NULL;
+    }
+    trace_t *trace = new trace_t();
+    trace->reversed = reversed;
+    const compressor_t *comp = find_compressor(file);
+    if (comp) {
+        fclose(file);
+        if (open_compressed_trace(trace, path, comp) < 0) {
+            trace_close(trace);
+            return NULL;
+        }
+        return trace;
+    }
+    if (!is_binary_trace(file)) {
+        trace->format = TRACE_TEXT;
+        trace->file = file;
+        return trace;
+    }
+    fclose(file);
+    trace->format = TRACE_BINARY;
+    if (map_binary_trace(trace, path) < 0) {
+        delete trace;
+        return NULL;
+    }
+    return trace;
+}
+
+/**
+ * @brief Read a synthetic workload as a binary trace, its records are generated as the buffer empties
+ *
+ * @param gen Generator of the records, freed with the trace
+ */
+trace_t *trace_open_stream(workload_stream *gen) {
+    trace_t *trace = new trace_t();
+    trace->format = TRACE_BINARY;
+    trace->gen = gen;
+    trace->buf = new uint64_t[TRACE_STREAM_RECS];
+    trace->cur = trace->end = trace->buf;
+    return trace;
+}
+
+void trace_close(trace_t *trace) {
+    if (trace == NULL) {
+        return;
+    }
+    if (trace->ring) {
+        trace->ring->stop.store(true, std::memory_order_relaxed);
+        trace->ring->reader.join();
+        delete[] trace->ring->recs;
+        delete trace->ring;
+    }
+    if (trace->file) {
+        fclose(trace->file);
+    }
+    if (trace->map) {
+        munmap(trace->map, trace->map_size);
+    }
+    if (trace->gen) {
+        workload_close(trace->gen);
+    }
+    delete[] trace->buf;
+    delete trace;
+}
+
+/**
+ * @brief Refill the buffer of a binary trace read as a stream
+ *
+ * @return true if records were read
+ */
+bool trace_refill(trace_t *trace) {
+    if (trace->buf == NULL) {
+        return false;
+    }
+    size_t n;
+    if (trace->gen) {
+        n = workload_fill(trace->gen, trace->buf, TRACE_STREAM_RECS);
+    } else {
+        n = fread(trace->buf, sizeof *trace->buf, TRACE_STREAM_RECS, trace->file);
+    }
+    trace->cur = trace->buf;
+    trace->end = trace->buf + n;
+    return n > 0;
+}
+
+/**
+ * @brief Skip entries of a trace, as many calls of trace_read would
+ *
+ * @return Entries skipped, less than n if the trace ended first
+ */
+uint64_t trace_skip(trace_t *trace, uint64_t n) {
+    if (trace->map && trace->ring == NULL) {
+        uint64_t k = std::min<uint64_t>(n, trace->end - trace->cur);
+        trace->cur += k;
+        return k;
+    }
+    for (uint64_t k = 0; k < n; k++) {
+        if (trace_eof(trace)) {
+            return k;
+        }
+        trace_read_rec(trace);
+    }
+    return n;
+}
+
+int trace_read_text(trace_t *trace, uint64_t *addr, int *rw) {
+    int ret = 0;
+    if (trace->reversed)
+        ret = fscanf(trace->file, "%d 0x%" SCNx64 "\n", rw, addr);
+    else
+        ret = fscanf(trace->file, "0x%" SCNx64 " %d\n", addr, rw);
+    if (ret == 2) {
+        return 1;
+    }
+    // Skip line
+    char *line = NULL;
+    size_t len = 0;
+    if (getline(&line, &len, trace->file) < 0 && !feof(trace->file)) {
+        perror("getline");
+    }
+    free(line);
+    return 0;
+}
+
+/**
+ * @brief Convert a text trace to the binary format. Lines that do not parse are kept as
+ * TRACE_REC_SKIP records so a binary trace replays exactly like its text version.
+ *
+ * @param reversed Text trace lines are (rw, addr) instead of (addr, rw)
+ * @return 0 on success, -1 on error
+ */
+int trace_convert(const char *in_path, bool reversed, const char *out_path) {
+    trace_t *in = trace_open(in_path, reversed);
+    if (in == NULL) {
+        return -1;
+    }
+    if (in->format != TRACE_TEXT) {
+        fprintf(stderr, "%s is already a binary trace\n", in_path);
+        trace_close(in);
+        return -1;
+    }
+    FILE *out = fopen(out_path, "wb");
+    if (out == NULL) {
+        perror("fopen");
+        trace_close(in);
+        return -1;
+    }
+    trace_header_t header = {};
+    memcpy(header.magic, TRACE_MAGIC, sizeof header.magic);
+    header.version = TRACE_VERSION;
+    fwrite(&header, sizeof header, 1, out);
+
+    static const size_t BUF_RECS = 1 << 16;
+    uint64_t *buf = new uint64_t[BUF_RECS];
+    size_t n = 0;
+    uint64_t num_recs = 0;
+    do {
+        buf[n++] = trace_read_rec(in);
+        if (n == BUF_RECS) {
+            fwrite(buf, sizeof *buf, n, out);
+            n = 0;
+        }
+        num_recs++;
+    } while (!trace_eof(in));
+    fwrite(buf, sizeof *buf, n, out);
+    delete[] buf;
+    trace_close(in);
+
+    int ret = 0;
+    if (ferror(out)) {
+        perror("fwrite");
+        ret = -1;
+    }
+    if (fclose(out) != 0) {
+        perror("fclose");
+        ret = -1;
+    }
+    if (ret == 0) {
+        printf("Converted %" PRIu64 " records to %s\n", num_recs, out_path);
+    }
+    return ret;
+}
+
+static void trace_reader(trace_t *trace) {
+    trace_ring_t *ring = trace->ring;
+    uint64_t head = 0, tail = 0;
+    bool eof;
+    do {
+        uint64_t addr;
+        int rw;
+        uint64_t rec = TRACE_REC_SKIP;
+        if (trace_read_file(trace, &addr, &rw)) {
+            rec = (addr & ~TRACE_REC_RW) | (rw ? TRACE_REC_RW : 0);
+        }
+        eof = trace_eof_file(trace);
+        while (head - tail == TRACE_RING_SIZE) {
+            ring->head.store(head, std::memory_order_release);
+            tail = ring->tail.load(std::memory_order_acquire);
+            if (head - tail < TRACE_RING_SIZE) {
+                break;
+            }
+            if (ring->stop.load(std::memory_order_relaxed)) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+        ring->recs[head & (TRACE_RING_SIZE - 1)] = rec;
+        head++;
+        if (eof) {
+            ring->end.store(head, std::memory_order_relaxed);
+        }
+        if (eof || head % TRACE_RING_BATCH == 0) {
+            ring->head.store(head, std::memory_order_release);
+        }
+    } while (!eof && !ring->stop.load(std::memory_order_relaxed));
+}
+
+/**
+ * @brief Decode a trace on its own thread from now on. trace_read returns the same records in the
+ * same order, buffered in a ring so parsing overlaps the simulation. Mapped binary traces are
+ * read in place.
+ */
+void trace_start_reader(trace_t *trace) {
+    if (trace->map || trace->ring) {
+        return;
+    }
+    trace_ring_t *ring = new trace_ring_t();
+    ring->recs = new uint64_t[TRACE_RING_SIZE];
+    ring->head.store(0);
+    ring->end.store(~0ULL);
+    ring->tail.store(0);
+    ring->stop.store(false);
+    ring->cached_head = 0;
+    ring->cached_tail = 0;
+    ring->eof = false;
+    trace->ring = ring;
+    ring->reader = std::thread(trace_reader, trace);
+}
@@ -0,0 +1,153 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <atomic>
+#include <thread>
+
+// Binary trace layout: a trace_header_t followed by one uint64_t record per access.
+// A record is the accessed address with bit 0 replaced by the R/W bit, bit 0 never
+// matters since addresses are only used at cache block granularity.
+#define TRACE_MAGIC "ITSTRACE"
+#define TRACE_VERSION 1
+#define TRACE_REC_RW 1ULL
+#define TRACE_REC_SKIP (~0ULL)          // Line of the text trace that did not parse
+
+typedef struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} trace_header_t;
+
+typedef enum {
+    TRACE_TEXT,
+    TRACE_BINARY,
+} trace_format_t;
+
+#define TRACE_RING_SIZE (1 << 16)       // Records buffered between a reader thread and the simulator
+#define TRACE_RING_BATCH 64             // Records pushed or popped between updates of head and tail
+
+// Single producer, single consumer ring of decoded records filled by a reader thread
+typedef struct trace_ring {
+    uint64_t *recs;                         // TRACE_RING_SIZE records, same encoding as binary traces
+    alignas(64) std::atomic<uint64_t> head; // Records pushed by the reader
+    std::atomic<uint64_t> end;              // Records in the trace once the reader reached its end
+    alignas(64) std::atomic<uint64_t> tail; // Records popped by the simulator
+    std::atomic<bool> stop;                 // The simulator is done, the reader quits
+    alignas(64) uint64_t cached_head;       // Simulator side copy of head
+    uint64_t cached_tail;                   // Simulator side tail, published every TRACE_RING_BATCH records
+    bool eof;                               // The last popped record was the last of the trace
+    std::thread reader;
+} trace_ring_t;
+
+struct workload_stream;
+
+typedef struct trace {
+    trace_format_t format;
+    FILE *file;                     // Text traces and compressed traces
+    bool reversed;                  // Text trace lines are (rw, addr) instead of (addr, rw)
+    void *map;                      // Binary traces are mapped whole
+    size_t map_size;
+    const uint64_t *cur;            // Next binary record
+    const uint64_t *end;
+    uint64_t *buf;                  // Binary traces read as a stream, NULL if mapped
+    workload_stream *gen;           // Synthetic workload filling buf instead of a file, NULL otherwise
+    trace_ring_t *ring;             // Decoded by a reader thread, NULL if read in place
+} trace_t;
+
+extern trace_t *trace_open(const char *path, bool reversed);
+extern trace_t *trace_open_stream(workload_stream *gen);
+extern void trace_close(trace_t *trace);
+extern int trace_read_text(trace_t *trace, uint64_t *addr, int *rw);
+extern bool trace_refill(trace_t *trace);
+extern int trace_convert(const char *in_path, bool reversed, const char *out_path);
+extern void trace_start_reader(trace_t *trace);
+extern uint64_t trace_skip(trace_t *trace, uint64_t n);
+
+static inline int trace_read_file(trace_t *trace, uint64_t *addr, int *rw) {
+    if (trace->format == TRACE_BINARY) {
+        if (trace->cur == trace->end && !trace_refill(trace)) {
+            return 0;
+        }
+        uint64_t rec = *trace->cur++;
+        if (rec == TRACE_REC_SKIP) {
+            return 0;
+        }
+        *addr = rec & ~TRACE_REC_RW;
+        *rw = rec & TRACE_REC_RW;
+        return 1;
+    }
+    return trace_read_text(trace, addr, rw);
+}
+
+static inline bool trace_eof_file(trace_t *trace) {
+    if (trace->format == TRACE_BINARY) {
+        return trace->cur == trace->end && !trace_refill(trace);
+    }
+    return feof(trace->file);
+}
+
+static inline uint64_t trace_ring_pop(trace_ring_t *ring) {
+    if (ring->eof) {
+        return TRACE_REC_SKIP;
+    }
+    uint64_t t = ring->cached_tail;
+    while (t == ring->cached_head) {
+        ring->cached_head = ring->head.load(std::memory_order_acquire);
+        if (t == ring->cached_head) {
+            ring->tail.store(t, std::memory_order_release);
+            std::this_thread::yield();
+        }
+    }
+    uint64_t rec = ring->recs[t & (TRACE_RING_SIZE - 1)];
+    ring->cached_tail = ++t;
+    if (t % TRACE_RING_BATCH == 0) {
+        ring->tail.store(t, std::memory_order_release);
+    }
+    ring->eof = ring->end.load(std::memory_order_relaxed) == t;
+    return rec;
+}
+
+/**
+ * @brief Read the next access of a trace
+ *
+ * @return 1 if addr and rw were filled in, 0 if this entry had no access (unparsable line)
+ */
+static inline int trace_read(trace_t *trace, uint64_t *addr, int *rw) {
+    if (trace->ring) {
+        uint64_t rec = trace_ring_pop(trace->ring);
+        if (rec == TRACE_REC_SKIP) {
+            return 0;
+        }
+        *addr = rec & ~TRACE_REC_RW;
+        *rw = rec & TRACE_REC_RW;
+        return 1;
+    }
+    return trace_read_file(trace, addr, rw);
+}
+
+/**
+ * @brief Read the next entry of a trace as a binary record
+ *
+ * @return The record, or TRACE_REC_SKIP if this entry had no access
+ */
+static inline uint64_t trace_read_rec(trace_t *trace) {
+    uint64_t addr;
+    int rw;
+    if (!trace_read(trace, &addr, &rw)) {
+        return TRACE_REC_SKIP;
+    }
+    return (addr & ~TRACE_REC_RW) | (rw ? TRACE_REC_RW : 0);
+}
+
+static inline bool trace_eof(trace_t *trace) {
+    if (trace->ring) {
+        return trace->ring->eof;
+    }
+    return trace_eof_file(trace);
+}
+
+#endif /* TRACE_HPP */
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include "cachesim.hpp"
+#include "workload.hpp"
+
+#define ZIPF_EXACT_TERMS (1ULL << 20)   // Terms of the zeta sum added one by one, the tail is integrated
+
+// Generator of the accesses of one node. The stream only depends on the configuration and the node,
+// so a workload replays identically however its entries are read.
+struct workload_stream {
+    workload_config_t config;
+    uint64_t node_id;
+    uint64_t pos;                   // Entries generated so far
+    uint64_t rng;                   // xorshift64 state, never 0
+    uint64_t lines;                 // Lines of the footprint, a power of two
+    double zipf_zetan;              // Zipf: zeta(lines, theta)
+    double zipf_eta;
+};
+
+static const char *const workload_names[] = {"uniform", "strided", "zipf", "migratory", "producer-consumer",
+                                             "false-sharing"};
+
+static inline uint64_t workload_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Uniform double in [0, 1)
+static inline double workload_unit(uint64_t *state) {
+    return (workload_rand(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+// Spread consecutive ranks over the footprint, a bijection on lines
+static inline uint64_t workload_scatter(uint64_t line, uint64_t lines) {
+    return (line * 0x9e3779b97f4a7c15ULL) & (lines - 1);
+}
+
+// Sum of i^-theta for i in 1..n, the terms past ZIPF_EXACT_TERMS approximated by an integral
+static double zipf_zeta(uint64_t n, double theta) {
+    uint64_t exact = std::min<uint64_t>(n, ZIPF_EXACT_TERMS);
+    double sum = 0;
+    for (uint64_t i = 1; i <= exact; i++) {
+        sum += pow((double)i, -theta);
+    }
+    if (n > exact) {
+        sum += (pow(n + 0.5, 1 - theta) - pow(exact + 0.5, 1 - theta)) / (1 - theta);
+    }
+    return sum;
+}
+
+/**
+ * @brief Zipfian rank in [0, lines), rank 0 the most popular, with the rejection-free method of Gray et al.
+ */
+static inline uint64_t zipf_next(workload_stream *s) {
+    double theta = s->config.theta;
+    double u = workload_unit(&s->rng);
+    double uz = u * s->zipf_zetan;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, theta)) {
+        return 1;
+    }
+    uint64_t rank = s->lines * pow(s->zipf_eta * u - s->zipf_eta + 1, 1 / (1 - theta));
+    return std::min(rank, s->lines - 1);
+}
+
+static int parse_size(const char *value, uint64_t *size) {
+    char *end;
+    uint64_t v = strtoull(value, &end, 10);
+    uint64_t shift = 0;
+    switch (*end) {
+    case 'K': case 'k': shift = 10; end++; break;
+    case 'M': case 'm': shift = 20; end++; break;
+    case 'G': case 'g': shift = 30; end++; break;
+    }
+    if (end == value || *end != '\0') {
+        return -1;
+    }
+    *size = v << shift;
+    return 0;
+}
+
+/**
+ * @brief Parse a workload given as pattern[:key=value,...]
+ *
+ * Keys are nodes, length, footprint, writes, seed, stride, theta, object, lag and chunk. Sizes take a
+ * K, M or G suffix.
+ *
+ * @return 0 on success, -1 on error
+ */
+int workload_parse(const char *spec, workload_config_t *config) {
+    config->num_nodes = 1;
+    config->length = WORKLOAD_LENGTH;
+    config->footprint = WORKLOAD_FOOTPRINT;
+    config->write_ratio = 0.3;
+    config->seed = 1;
+    config->stride = 1ULL << WORKLOAD_LINE;
+    config->theta = 0.99;
+    config->object = 8ULL << WORKLOAD_LINE;
+    config->lag = 0;
+    config->chunk = 8ULL << WORKLOAD_LINE;
+    size_t name_len = strcspn(spec, ":");
+    int pattern = -1;
+    for (int p = 0; p < WORKLOAD_PATTERNS; p++) {
+        if (strlen(workload_names[p]) == name_len && strncmp(spec, workload_names[p], name_len) == 0) {
+            pattern = p;
+        }
+    }
+    if (pattern < 0) {
+        fprintf(stderr, "Unknown workload pattern in %s\n", spec);
+        return -1;
+    }
+    config->pattern = (workload_pattern_t)pattern;
+    char *params = strdup(spec[name_len] ? spec + name_len + 1 : "");
+    int ret = 0;
+    for (char *save, *param = strtok_r(params, ",", &save); param && ret == 0;
+         param = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(param, '=');
+        if (value == NULL) {
+            fprintf(stderr, "Workload parameter %s has no value\n", param);
+            ret = -1;
+            break;
+        }
+        *value++ = '\0';
+        char *end = NULL;
+        if (strcmp(param, "nodes") == 0) {
+            config->num_nodes = strtoull(value, &end, 10);
+        } else if (strcmp(param, "length") == 0) {
+            ret = parse_size(value, &config->length);
+        } else if (strcmp(param, "footprint") == 0) {
+            ret = parse_size(value, &config->footprint);
+        } else if (strcmp(param, "writes") == 0) {
+            config->write_ratio = strtod(value, &end);
+        } else if (strcmp(param, "seed") == 0) {
+            config->seed = strtoull(value, &end, 10);
+        } else if (strcmp(param, "stride") == 0) {
+            ret = parse_size(value, &config->stride);
+        } else if (strcmp(param, "theta") == 0) {
+            config->theta = strtod(value, &end);
+        } else if (strcmp(param, "object") == 0) {
+            ret = parse_size(value, &config->object);
+        } else if (strcmp(param, "lag") == 0) {
+            ret = parse_size(value, &config->lag);
+        } else if (strcmp(param, "chunk") == 0) {
+            ret = parse_size(value, &config->chunk);
+        } else {
+            fprintf(stderr, "Unknown workload parameter %s\n", param);
+            ret = -1;
+            break;
+        }
+        if (ret < 0 || (end && (end == value || *end != '\0'))) {
+            fprintf(stderr, "Bad value %s of workload parameter %s\n", value, param);
+            ret = -1;
+        }
+    }
+    free(params);
+    if (ret < 0) {
+        return -1;
+    }
+    uint64_t line = 1ULL << WORKLOAD_LINE;
+    uint64_t footprint = line;
+    while (footprint < config->footprint) {
+        footprint <<= 1;
+    }
+    config->footprint = footprint;
+    if (config->num_nodes == 0 || config->num_nodes > MAX_NODES) {
+        fprintf(stderr, "A workload has 1 to %d nodes\n", MAX_NODES);
+        return -1;
+    }
+    if (config->write_ratio < 0 || config->write_ratio > 1) {
+        fprintf(stderr, "The write ratio of a workload is between 0 and 1\n");
+        return -1;
+    }
+    // The closed form of zipf_next is only valid for skews below 1
+    if (!(config->theta > 0 && config->theta < 1)) {
+        fprintf(stderr, "The zipf skew is between 0 and 1, both excluded\n");
+        return -1;
+    }
+    if (config->object < line || config->object > footprint || config->chunk < line ||
+        config->chunk > footprint || config->stride == 0) {
+        fprintf(stderr, "Workload objects and chunks are at least a line and fit in the footprint, strides are not 0\n");
+        return -1;
+    }
+    return 0;
+}
+
+void workload_print(const workload_config_t *config) {
+    printf("Workload: %s, %" PRIu64 " nodes, %" PRIu64 " accesses per node, footprint %" PRIu64
+           " bytes, seed %" PRIu64 "\n", workload_names[config->pattern], config->num_nodes, config->length,
+           config->footprint, config->seed);
+}
+
+/**
+ * @brief Open the accesses of one node of a workload as a trace
+ *
+ * @return The trace, read like a binary trace streamed from a file
+ */
+trace_t *workload_open(const workload_config_t *config, uint64_t node_id) {
+    workload_stream *s = new workload_stream();
+    s->config = *config;
+    s->node_id = node_id;
+    s->pos = 0;
+    s->rng = config->seed * 0x9e3779b97f4a7c15ULL + (node_id + 1) * 0xbf58476d1ce4e5b9ULL;
+    if (s->rng == 0) {
+        s->rng = 1;
+    }
+    s->lines = config->footprint >> WORKLOAD_LINE;
+    if (config->pattern == WORKLOAD_ZIPF) {
+        double theta = config->theta;
+        s->zipf_zetan = zipf_zeta(s->lines, theta);
+        s->zipf_eta = (1 - pow(2.0 / s->lines, 1 - theta)) / (1 - zipf_zeta(2, theta) / s->zipf_zetan);
+    }
+    return trace_open_stream(s);
+}
+
+static inline uint64_t workload_rec(uint64_t line, bool rw) {
+    return (line << WORKLOAD_LINE) | (rw ? TRACE_REC_RW : 0);
+}
+
+/**
+ * @brief Generate the next records of a node
+ *
+ * @return Records generated, 0 once the node made all its accesses
+ */
+size_t workload_fill(workload_stream *s, uint64_t *recs, size_t n) {
+    const workload_config_t *config = &s->config;
+    n = std::min<uint64_t>(n, config->length - s->pos);
+    uint64_t lines = s->lines;
+    uint64_t num_nodes = config->num_nodes;
+    uint64_t node_id = s->node_id;
+    // Writes are drawn by comparing a random 32-bit value to the ratio
+    uint64_t write_thresh = config->write_ratio * 4294967296.0;
+    uint64_t pos = s->pos;
+    switch (config->pattern) {
+    case WORKLOAD_UNIFORM:
+        for (size_t i = 0; i < n; i++) {
+            uint64_t r = workload_rand(&s->rng);
+            recs[i] = workload_rec((r >> 16) & (lines - 1), (r & 0xffffffff) < write_thresh);
+        }
+        break;
+    case WORKLOAD_STRIDED: {
+        uint64_t base = node_id * (config->footprint / num_nodes);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t addr = (base + (pos + i) * config->stride) & (config->footprint - 1);
+            recs[i] = workload_rec(addr >> WORKLOAD_LINE, (workload_rand(&s->rng) & 0xffffffff) < write_thresh);
+        }
+        break;
+    }
+    case WORKLOAD_ZIPF:
+        for (size_t i = 0; i < n; i++) {
+            uint64_t line = workload_scatter(zipf_next(s), lines);
+            recs[i] = workload_rec(line, (workload_rand(&s->rng) & 0xffffffff) < write_thresh);
+        }
+        break;
+    case WORKLOAD_MIGRATORY: {
+        // Each line of an object is read then written. In every phase node n works on object p + n, so
+        // an object moves on to the previous node in the next phase.
+        uint64_t object_lines = config->object >> WORKLOAD_LINE;
+        uint64_t num_objects = lines / object_lines;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t phase = (pos + i) / (2 * object_lines);
+            uint64_t offset = (pos + i) % (2 * object_lines);
+            uint64_t object = (phase + node_id) % num_objects;
+            recs[i] = workload_rec(object * object_lines + offset / 2, offset & 1);
+        }
+        break;
+    }
+    case WORKLOAD_PRODUCER_CONSUMER: {
+        // Node pairs share a ring buffer, the producer writes it in order and the consumer reads lag
+        // accesses behind. A last node without a consumer only produces.
+        uint64_t num_pairs = (num_nodes + 1) / 2;
+        uint64_t ring_lines = std::max<uint64_t>(1, lines / num_pairs);
+        uint64_t base = node_id / 2 * ring_lines;
+        bool consumer = node_id & 1;
+        uint64_t lag = consumer ? config->lag % ring_lines : 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t line = base + (pos + i + ring_lines - lag) % ring_lines;
+            recs[i] = workload_rec(line, !consumer);
+        }
+        break;
+    }
+    case WORKLOAD_FALSE_SHARING: {
+        // Every node has its own lines in each chunk, node n the lines n, n + nodes, ... so no data line
+        // is shared while the tree counters covering the chunk are
+        uint64_t chunk_lines = config->chunk >> WORKLOAD_LINE;
+        uint64_t num_chunks = lines / chunk_lines;
+        uint64_t own_lines = std::max<uint64_t>(1, chunk_lines / num_nodes);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t r = workload_rand(&s->rng);
+            uint64_t chunk = (r >> 32) % num_chunks;
+            uint64_t line = (node_id + (r >> 8 & 0xffffff) % own_lines * num_nodes) % chunk_lines;
+            recs[i] = workload_rec(chunk * chunk_lines + line, (r & 0xff) < (write_thresh >> 24));
+        }
+        break;
+    }
+    default:
+        n = 0;
+        break;
+    }
+    s->pos += n;
+    return n;
+}
+
+void workload_close(workload_stream *stream) {
+    delete stream;
+}
@@ -0,0 +1,41 @@
+#ifndef WORKLOAD_HPP
+#define WORKLOAD_HPP
+
+#include <stdint.h>
+#include "trace.hpp"
+
+#define WORKLOAD_LINE 6                 // Data line of the generated addresses (log bytes)
+#define WORKLOAD_LENGTH 10000000        // Default accesses per node
+#define WORKLOAD_FOOTPRINT (1ULL << 30) // Default bytes touched by all nodes together
+
+typedef enum {
+    WORKLOAD_UNIFORM,               // Random lines of the footprint
+    WORKLOAD_STRIDED,               // Each node sweeps its slice of the footprint with a fixed stride
+    WORKLOAD_ZIPF,                  // Zipfian popularity over the lines, a hot set shared by all nodes
+    WORKLOAD_MIGRATORY,             // Objects read then written by one node after the other
+    WORKLOAD_PRODUCER_CONSUMER,     // Even nodes write a buffer the next odd node reads behind them
+    WORKLOAD_FALSE_SHARING,         // Nodes write their own lines of chunks whose metadata they share
+    WORKLOAD_PATTERNS,
+} workload_pattern_t;
+
+typedef struct workload_config {
+    workload_pattern_t pattern;
+    uint64_t num_nodes;
+    uint64_t length;                // Accesses per node
+    uint64_t footprint;             // Bytes, rounded up to a power of two
+    double write_ratio;             // Uniform, strided, zipf and false sharing
+    uint64_t seed;
+    uint64_t stride;                // Strided: bytes between two accesses of a node
+    double theta;                   // Zipf: skew, between 0 and 1 excluded
+    uint64_t object;                // Migratory: bytes of an object
+    uint64_t lag;                   // Producer-consumer: accesses the consumer trails the producer by
+    uint64_t chunk;                 // False sharing: bytes of a chunk whose lines the nodes split
+} workload_config_t;
+
+extern int workload_parse(const char *spec, workload_config_t *config);
+extern void workload_print(const workload_config_t *config);
+extern trace_t *workload_open(const workload_config_t *config, uint64_t node_id);
+extern size_t workload_fill(workload_stream *stream, uint64_t *recs, size_t n);
+extern void workload_close(workload_stream *stream);
+
+#endif /* WORKLOAD_HPP */